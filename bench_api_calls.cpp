@@ -0,0 +1,83 @@
+//Microbenchmark of the cost of calling a plugin function.
+//Compares a direct call, a call trough a copy of the api struct and a call trough the registry table, which
+//with SP_API_TRAMPOLINES holds trampolines that jump to the plugin.
+
+#include<Windows.h>
+
+#include <stdio.h>
+
+#define SP_API_TRAMPOLINES
+#define SIMPLE_PLUGIN_IMPLEMENTATION
+#include "simple_plugin.h"
+
+#define BENCH_ITERATIONS 100000000
+
+//The api is registered by the host itself so the benchmark does not need a dll.
+struct bench_api
+{
+    SP_API_FUNCTION(int32, add, (int32,int32));
+};
+SP_DECLARE_API(bench_api);
+
+__declspec(noinline) int32
+add(int32 a, int32 b)
+{
+    return(a + b);
+}
+
+internal double
+bench_ns_per_call(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    double seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+    return(seconds * 1e9 / BENCH_ITERATIONS);
+}
+
+int main()
+{
+    APIRegistry registry = sp_registry_create(4);
+    APIRegistry *reg = &registry;
+
+    bench_api api = {};
+    api.add = add;
+    reg->add(SP_API_KEY(bench_api), &api, sizeof(api), false, reg);
+    //An api added outside of a plugin load is visible once the registry is updated.
+    sp_update(reg);
+
+    //The api struct as the plugin filled it in, and the table the registry hands out.
+    //volatile so the compiler can not turn the indirect calls into direct ones.
+    bench_api * volatile struct_api = &api;
+    bench_api * volatile table_api  = sp_get_api<bench_api>(reg);
+    SP_Assert(table_api->add(1,2) == 3);
+
+    volatile int32 sink = 0;
+    LARGE_INTEGER start, end;
+
+    QueryPerformanceCounter(&start);
+    for(int32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        sink = add(sink, 1);
+    }
+    QueryPerformanceCounter(&end);
+    printf("direct call     : %.2f ns\n", bench_ns_per_call(start, end));
+
+    QueryPerformanceCounter(&start);
+    for(int32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        sink = struct_api->add(sink, 1);
+    }
+    QueryPerformanceCounter(&end);
+    printf("api struct call : %.2f ns\n", bench_ns_per_call(start, end));
+
+    QueryPerformanceCounter(&start);
+    for(int32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        sink = table_api->add(sink, 1);
+    }
+    QueryPerformanceCounter(&end);
+    printf("trampoline call : %.2f ns\n", bench_ns_per_call(start, end));
+
+    sp_registry_destroy(reg);
+    return(0);
+}
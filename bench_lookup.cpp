@@ -0,0 +1,118 @@
+//Benchmark of sp_get_api as the registry grows.
+//The lookup goes trough the api_hash index, so the time per lookup should stay flat from 10 to 10000 APIs.
+//It also times rebuilding the read view, the one path that still walks every api of the registry.
+
+#include<Windows.h>
+
+#include <stdio.h>
+
+#define SIMPLE_PLUGIN_IMPLEMENTATION
+#include "simple_plugin.h"
+
+#define BENCH_LOOKUPS 10000000
+#define BENCH_PUBLISHES 1000
+
+//The apis are registered by the host itself so the benchmark does not need any dll, they all share one struct.
+struct bench_api
+{
+    SP_API_FUNCTION(int32, value, ());
+};
+
+internal int32
+bench_value()
+{
+    return(1);
+}
+
+global_variable bench_api bench_shared_api = {bench_value};
+
+internal sp_api_key
+bench_key(uint32 index)
+{
+    //Any non zero hash will do, these are spread out like real ones.
+    sp_api_key key = {(index + 1) * 0x9E3779B97F4A7C15ull};
+    return(key);
+}
+
+internal double
+bench_seconds(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return((double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart);
+}
+
+//Times a full rebuild of the read view.
+internal void
+bench_publish(uint32 api_count)
+{
+    APIRegistry registry = sp_registry_create(api_count + 1);
+    APIRegistry *reg = &registry;
+    for(uint32 index = 0; index < api_count; ++index)
+    {
+        reg->add(bench_key(index), &bench_shared_api, sizeof(bench_shared_api), false, reg);
+    }
+    sp_update(reg);
+
+    LARGE_INTEGER start, end;
+    double publish_seconds = 0.0;
+    for(uint32 i = 0; i < BENCH_PUBLISHES; ++i)
+    {
+        QueryPerformanceCounter(&start);
+        reg->view_dirty = true;
+        sp_internal_registry_publish(reg);
+        QueryPerformanceCounter(&end);
+        publish_seconds += bench_seconds(start, end);
+        //Frees the view that was just retired, not part of the timing.
+        sp_update(reg);
+    }
+
+    printf("%5u apis : %.2f us per read view rebuild\n", api_count, publish_seconds * 1e6 / BENCH_PUBLISHES);
+    sp_registry_destroy(reg);
+}
+
+int main()
+{
+    uint32 sizes[] = {10, 100, 1000, 10000};
+    for(uint32 size_index = 0; size_index < sizeof(sizes) / sizeof(sizes[0]); ++size_index)
+    {
+        uint32 api_count = sizes[size_index];
+        APIRegistry registry = sp_registry_create(api_count + 1);
+        APIRegistry *reg = &registry;
+
+        sp_api_key *keys = (sp_api_key*)malloc(sizeof(sp_api_key) * api_count);
+        for(uint32 index = 0; index < api_count; ++index)
+        {
+            keys[index] = bench_key(index);
+            reg->add(keys[index], &bench_shared_api, sizeof(bench_shared_api), false, reg);
+        }
+        //Apis added outside of a plugin load are visible once the registry is updated.
+        sp_update(reg);
+
+        //Walk the keys with a stride so consecutive lookups do not hit neighbouring buckets.
+        bench_api * volatile sink = 0;
+        uint32 key_index = 0;
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        for(uint32 i = 0; i < BENCH_LOOKUPS; ++i)
+        {
+            sink = (bench_api*)sp_get_api(reg, keys[key_index]);
+            key_index += 7919;
+            if(key_index >= api_count)
+            {
+                key_index %= api_count;
+            }
+        }
+        QueryPerformanceCounter(&end);
+        SP_Assert(sink->value() == 1);
+
+        printf("%5u apis : %.2f ns per sp_get_api\n", api_count, bench_seconds(start, end) * 1e9 / BENCH_LOOKUPS);
+
+        free(keys);
+        sp_registry_destroy(reg);
+    }
+
+    bench_publish(1000);
+    bench_publish(10000);
+    return(0);
+}
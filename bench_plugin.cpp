@@ -0,0 +1,40 @@
+//Plugin used by bench_startup.cpp.
+//bench_startup copies bench_plugin.dll to bench_plugin_000.dll ... bench_plugin_099.dll so the host can start up with
+//many plugins. A plugin is found trough the load function named after its file, so this dll exports one load and one
+//unload function for every copy, each of them registers its own API.
+
+#include "simple_plugin.h"
+
+struct bench_plugin_api
+{
+    SP_API_FUNCTION(int32, value, ());
+};
+
+internal int32
+bench_value()
+{
+    return(1);
+}
+
+global_variable bench_plugin_api bench_api = {bench_value};
+
+#define BENCH_PLUGIN(n) \
+    SP_EXPORT void load_bench_plugin_##n(APIRegistry *reg, bool32 reload = false) \
+    { \
+        reg->add(SP_API_KEY(bench_plugin_##n##_api), &bench_api, sizeof(bench_api), reload, reg); \
+    } \
+    SP_EXPORT void unload_bench_plugin_##n(APIRegistry *reg, bool32 reload) \
+    { \
+        reg->remove(SP_API_KEY(bench_plugin_##n##_api), reload, reg); \
+    }
+
+#define BENCH_PLUGIN_10(n) \
+    BENCH_PLUGIN(n##0) BENCH_PLUGIN(n##1) BENCH_PLUGIN(n##2) BENCH_PLUGIN(n##3) BENCH_PLUGIN(n##4) \
+    BENCH_PLUGIN(n##5) BENCH_PLUGIN(n##6) BENCH_PLUGIN(n##7) BENCH_PLUGIN(n##8) BENCH_PLUGIN(n##9)
+
+#define BENCH_PLUGIN_100(n) \
+    BENCH_PLUGIN_10(n##0) BENCH_PLUGIN_10(n##1) BENCH_PLUGIN_10(n##2) BENCH_PLUGIN_10(n##3) BENCH_PLUGIN_10(n##4) \
+    BENCH_PLUGIN_10(n##5) BENCH_PLUGIN_10(n##6) BENCH_PLUGIN_10(n##7) BENCH_PLUGIN_10(n##8) BENCH_PLUGIN_10(n##9)
+
+//bench_plugin_000 ... bench_plugin_099
+BENCH_PLUGIN_100(0)
@@ -0,0 +1,83 @@
+//Benchmark of starting up with many plugins, loading them one by one with sp_load_plugin against one sp_load_plugins batch.
+//Needs bench_plugin.dll in the working directory, it is copied to BENCH_PLUGIN_COUNT plugins (See bench_plugin.cpp).
+//@NOTE: After the first round the files are in the OS file cache, the first round is the closest to a cold start.
+
+#include<Windows.h>
+
+#include <stdio.h>
+
+#define SIMPLE_PLUGIN_IMPLEMENTATION
+#include "simple_plugin.h"
+
+//Every copy is reloadable, so this stays within SP_MAX_RELOADABLE_PLUGINS.
+#define BENCH_PLUGIN_COUNT 100
+#define BENCH_ROUNDS       3
+
+global_variable char bench_names[BENCH_PLUGIN_COUNT][32];
+global_variable char *bench_name_list[BENCH_PLUGIN_COUNT];
+
+internal double
+bench_ms(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return((double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart);
+}
+
+internal double
+bench_load_serial()
+{
+    APIRegistry registry = sp_registry_create(BENCH_PLUGIN_COUNT);
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    for(uint32 index = 0; index < BENCH_PLUGIN_COUNT; ++index)
+    {
+        SPlugin *plugin = sp_load_plugin(&registry, bench_name_list[index], true);
+        SP_Assert(plugin);
+    }
+    QueryPerformanceCounter(&end);
+    sp_registry_destroy(&registry);
+    return(bench_ms(start, end));
+}
+
+internal double
+bench_load_batch()
+{
+    APIRegistry registry = sp_registry_create(BENCH_PLUGIN_COUNT);
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    uint32 loaded = sp_load_plugins(&registry, bench_name_list, BENCH_PLUGIN_COUNT, SP_LOAD_RELOADABLE);
+    QueryPerformanceCounter(&end);
+    SP_Assert(loaded == BENCH_PLUGIN_COUNT);
+    sp_registry_destroy(&registry);
+    return(bench_ms(start, end));
+}
+
+int main()
+{
+    for(uint32 index = 0; index < BENCH_PLUGIN_COUNT; ++index)
+    {
+        sprintf(bench_names[index], "bench_plugin_%03u.dll", index);
+        bench_name_list[index] = bench_names[index];
+        if(!CopyFileA("bench_plugin.dll", bench_names[index], FALSE))
+        {
+            printf("Could not copy bench_plugin.dll, build it and run this from the build directory\n");
+            return(1);
+        }
+    }
+
+    //Alternate the two so neither one always gets the warmer file cache.
+    for(uint32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        double serial = bench_load_serial();
+        double batch  = bench_load_batch();
+        printf("round %u, %u plugins : sp_load_plugin %.2f ms, sp_load_plugins %.2f ms (%.1fx)\n",
+               round, BENCH_PLUGIN_COUNT, serial, batch, serial / batch);
+    }
+
+    for(uint32 index = 0; index < BENCH_PLUGIN_COUNT; ++index)
+    {
+        DeleteFileA(bench_names[index]);
+    }
+    return(0);
+}
@@ -0,0 +1,116 @@
+//Benchmark of sp_get_api from many threads at once, while the main thread keeps calling sp_update.
+//Build it with and without SP_ENABLE_THREAD_CACHE and compare, the thread cache only pays off when the read view
+//is contended. The number of threads can be given on the command line, the default is 16.
+
+#include<Windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIMPLE_PLUGIN_IMPLEMENTATION
+#include "simple_plugin.h"
+
+#define BENCH_API_COUNT   8
+#define BENCH_ITERATIONS  10000000
+#define BENCH_MAX_THREADS 64
+
+//The apis are registered by the host itself so the benchmark does not need any dll.
+struct bench_api
+{
+    SP_API_FUNCTION(int32, value, ());
+};
+
+internal int32
+bench_value()
+{
+    return(1);
+}
+
+global_variable APIRegistry bench_registry;
+global_variable bench_api bench_apis[BENCH_API_COUNT];
+global_variable HANDLE bench_start_event;
+
+internal sp_api_key
+bench_key(uint32 index)
+{
+    //Any non zero hash will do, these are spread out like real ones.
+    sp_api_key key = {(index + 1) * 0x9E3779B97F4A7C15ull};
+    return(key);
+}
+
+DWORD WINAPI
+bench_thread(LPVOID parameter)
+{
+    volatile int32 *sink = (volatile int32 *)parameter;
+    SPReader *reader = sp_reader_register(&bench_registry);
+    WaitForSingleObject(bench_start_event, INFINITE);
+
+    int32 sum = 0;
+    for(uint32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        bench_api *api = (bench_api*)sp_get_api(&bench_registry, bench_key(i % BENCH_API_COUNT));
+        sum += api->value();
+        if((i & 1023) == 0)
+        {
+            sp_reader_quiescent(reader);
+        }
+    }
+    *sink = sum;
+
+    sp_reader_unregister(reader);
+    return(0);
+}
+
+int main(int argc, char **argv)
+{
+    uint32 thread_count = (argc > 1) ? (uint32)atoi(argv[1]) : 16;
+    if(thread_count < 1 || thread_count > BENCH_MAX_THREADS)
+    {
+        thread_count = 16;
+    }
+
+    bench_registry = sp_registry_create(BENCH_API_COUNT);
+    APIRegistry *reg = &bench_registry;
+    for(uint32 index = 0; index < BENCH_API_COUNT; ++index)
+    {
+        bench_apis[index].value = bench_value;
+        reg->add(bench_key(index), &bench_apis[index], sizeof(bench_api), false, reg);
+    }
+    //Apis added outside of a plugin load are visible once the registry is updated.
+    sp_update(reg);
+
+    bench_start_event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    HANDLE threads[BENCH_MAX_THREADS];
+    volatile int32 sinks[BENCH_MAX_THREADS];
+    for(uint32 index = 0; index < thread_count; ++index)
+    {
+        threads[index] = CreateThread(nullptr, 0, bench_thread, (LPVOID)&sinks[index], 0, nullptr);
+    }
+
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    SetEvent(bench_start_event);
+    while(WaitForMultipleObjects(thread_count, threads, TRUE, 0) == WAIT_TIMEOUT)
+    {
+        sp_update(reg);
+    }
+    QueryPerformanceCounter(&end);
+
+    double seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+    #ifdef SP_ENABLE_THREAD_CACHE
+    const char *mode = "thread cache";
+    #else
+    const char *mode = "read view";
+    #endif //SP_ENABLE_THREAD_CACHE
+    //Wall time per lookup of one thread, lower is better. With no contention it stays flat as threads are added.
+    printf("%s, %u threads : %.2f ns per sp_get_api\n", mode, thread_count, seconds * 1e9 / BENCH_ITERATIONS);
+
+    for(uint32 index = 0; index < thread_count; ++index)
+    {
+        CloseHandle(threads[index]);
+    }
+    CloseHandle(bench_start_event);
+    sp_registry_destroy(reg);
+    return(0);
+}
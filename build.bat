@@ -2,10 +2,23 @@
 IF NOT EXIST ..\build mkdir ..\build 
 pushd ..\build 
 cl -nologo -MDd ..\code\simple_plugin.cpp -FC -Z7 -FmSimplePlugin.map /link -incremental:no -subsystem:console /PDB:SimplePlugin.pdb 
+cl -nologo -O2 -MD ..\code\bench_lookup.cpp -FC -Z7 /link -incremental:no -subsystem:console /PDB:bench_lookup.pdb 
+cl -nologo -O2 -MD ..\code\bench_api_calls.cpp -FC -Z7 /link -incremental:no -subsystem:console /PDB:bench_api_calls.pdb 
+cl -nologo -O2 -MD ..\code\bench_thread_cache.cpp -FC -Z7 /link -incremental:no -subsystem:console /PDB:bench_thread_cache.pdb 
+cl -nologo -O2 -MD -DSP_ENABLE_THREAD_CACHE ..\code\bench_thread_cache.cpp -FC -Z7 -Febench_thread_cache_enabled.exe /link -incremental:no -subsystem:console /PDB:bench_thread_cache_enabled.pdb 
+cl -nologo -O2 -MD ..\code\bench_startup.cpp -FC -Z7 /link -incremental:no -subsystem:console /PDB:bench_startup.pdb 
+cl -LD -nologo -O2 -MD ..\code\bench_plugin.cpp -FC -Z7 /link -incremental:no -subsystem:console /PDB:bench_plugin.pdb 
 cl -LD -nologo -MDd ..\code\sample_plugin.cpp -FC -Z7 -Fmsample_plugin.map /link  -incremental:no -subsystem:console /PDB:sample_plugin.%RANDOM%.pdb 
 cl -LD -nologo -MDd ..\code\second_plugin.cpp -FC -Z7 -Fmsecond_plugin.map /link  -incremental:no -subsystem:console /PDB:second_plugin.%RANDOM%.pdb 
+cl -nologo -MDd ..\code\test_reload.cpp -FC -Z7 /link -incremental:no -subsystem:console /PDB:test_reload.pdb 
+cl -nologo -MDd -DSP_DISABLE_FILE_WATCHER ..\code\test_reload.cpp -FC -Z7 -Fetest_reload_polling.exe /link -incremental:no -subsystem:console /PDB:test_reload_polling.pdb 
+cl -nologo -MDd -DSP_ASYNC_RELOAD ..\code\test_reload.cpp -FC -Z7 -Fetest_reload_async.exe /link -incremental:no -subsystem:console /PDB:test_reload_async.pdb 
 rem cl -LD -nologo -MDd ..\code\third_plugin.cpp -FC -Z7 -Fmthird_plugin.map /link  -incremental:no -subsystem:console /PDB:third_plugin.%RANDOM%.pdb 
 rem cl -LD -nologo -MDd ..\code\fourth_plugin.cpp -FC -Z7 -Fmfourth_plugin.map /link  -incremental:no -subsystem:console /PDB:fourth_plugin.%RANDOM%.pdb 
 
+test_reload.exe 
+test_reload_polling.exe 
+test_reload_async.exe 
+
 
 popd 
@@ -102,11 +102,33 @@
 //
 //     This macro expands to the following :
 //
-//     SP_REGISTER_API(registry,api_struct_name,reload) reg->add(#api_struct_name,&api_struct_name,reload, reg)
+//     SP_REGISTER_API(registry,api_struct_name,reload) reg->add(SP_API_KEY(api_struct_name),&api_struct_name,sizeof(api_struct_name),reload, reg)
 //
-//     As you can see we are just calling the APIRegistry add method, passing in the api_struct_name as a string,
-//     (this is hashed and used internally to id the API), the address of the API structure instance we created and the 
+//     As you can see we are just calling the APIRegistry add method, passing in the key of the api_struct_name,
+//     (SP_API_KEY hashes the name at compile time and it is used internally to id the API), the address and size of the API structure instance we created and the 
 //     reload variable.
+//
+//     The registry copies the API struct into memory it owns. When the plugin is hot reloaded, the new version fills in that same
+//     struct, so client code can keep the API pointer it got from sp_get_api.
+//     The exception is a new version that changed the size of the API struct (ex: added a function), it gets a new struct and
+//     the old one is freed. Client code that keeps the pointer gets it again when sp_get_generation() changed.
+//
+//   5) [Getting the plugin state] (optional)
+//
+//      If the plugin has state that should survive a hot reload, ask the registry for it instead of keeping it in globals.
+//
+//      SP_GET_STATE(registry, api_struct_name, state_struct_name, version, migrate) 
+//
+//      state_struct_name - the struct that holds the state, declared in the header (in this case sample_plugin_state).
+//
+//      version           - the version of the layout of the state struct.
+//
+//      migrate           - function that fills in the new state from the old one when the version or size of the state changed,
+//                          can be nullptr in which case the new state starts zeroed.
+//                          void migrate(void *old_state, uint32 old_size, uint32 old_version, void *new_state, uint32 new_size)
+//
+//      The first time it is called it returns zeroed memory owned by the registry. When the plugin is reloaded the new version
+//      gets the same memory back, with whatever the old version left in it. It is freed when the plugin is unloaded.
 //-------------------------------------------------------------------------------------------------------------
 
 
@@ -143,7 +165,7 @@
 //
 //       The macro expands to the following:
 //
-//       SP_REMOVE_API(registry, api_struct_name, reload) reg->remove(#api_struct_name, reload, reg);
+//       SP_REMOVE_API(registry, api_struct_name, reload) reg->remove(SP_API_KEY(api_struct_name), reload, reg);
 //       
 //       As you can see all we are doing is calling the remove method of the APIRegistry.
 //
@@ -189,9 +211,14 @@
 //         sample_plugin.api.my_print = my_print_with_different_name;
 //
 //---
+
+//Owned by the registry, see load_sample_plugin.
+static sample_plugin_state *plugin_state;
+
 void my_print()
 {
-    printf("@@@@@@@  #######  @@@@@@@ \n");
+    plugin_state->print_count++;
+    printf("@@@@@@@  #######  @@@@@@@ (%d)\n", plugin_state->print_count);
 }
 
 void my_add_and_print(int a, int b)
@@ -212,6 +239,9 @@ SP_EXPORT void load_sample_plugin(APIRegistry *reg, bool32 reload = false)
 {
     printf("I have been loaded now I can do something\n");
 
+    //Getting the state, after a reload this is the state the previous version left behind
+    plugin_state = SP_GET_STATE(reg, sample_plugin_api, sample_plugin_state, SAMPLE_PLUGIN_STATE_VERSION, nullptr);
+
     //Creating the API
 
     //static sample_plugin_api sample_plugin_api = {};
@@ -228,7 +258,7 @@ SP_EXPORT void load_sample_plugin(APIRegistry *reg, bool32 reload = false)
     
     //Registering the API
     SP_REGISTER_API(reg, sample_plugin_api, reload);
-    //reg->add("sample_plugin_api", &api, reload, reg);
+    //reg->add(SP_API_KEY(sample_plugin_api), &sample_plugin_api, sizeof(sample_plugin_api), reload, reg);
 }
 
 //---
@@ -243,8 +273,7 @@ SP_EXPORT void unload_sample_plugin(APIRegistry *reg, bool32 reload)
     //Any clean up or any other stuff you want to do here...
 
     SP_REMOVE_API(reg, sample_plugin_api, reload);
-    //reg->remove(PLUGIN_EXAMPLE_API_NAME, reload,reg);
-    //reg->remove("sample_plugin_api", reload, reg);
+    //reg->remove(SP_API_KEY(sample_plugin_api), reload, reg);
 }
 
 
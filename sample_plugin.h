@@ -19,6 +19,10 @@
 //      * The name of this struct MUST be the same name that PLUGIN_NAME_API_NAME resolves too, this is because this will be the 
 //        name that client code will use to load the API.
 //
+// * Declare the api key - SP_DECLARE_API(plugin_name_api) right after the struct.
+//      * This lets client code ask for the API by type with sp_get_api<plugin_name_api>(), the name is hashed at compile time
+//        and no cast is needed.
+//
 //-------------------------------------------------------------------------------------------------------------
  
 //-------------------------------------------------------------------------------------------------------------
@@ -58,12 +62,14 @@ struct sample_plugin_api
     //void (*my_add_and_print)(int,int);
     SP_API_FUNCTION(void, my_add_and_print, (int,int) );
 };
+//Lets client code use the typed sp_get_api<sample_plugin_api>()
+SP_DECLARE_API(sample_plugin_api);
 
-/*FOR FUTURE RELEASE
-//Keep any global or heap allocated state here, this can be used if we want to transfer
-//state between two plugins of the same kind. For example in hot reloading.
-struct plugin_state
+//Keep any global or heap allocated state here. The registry owns this struct and hands the same memory to the new version
+//of the plugin when it is hot reloaded, so nothing has to be rebuilt (see SP_GET_STATE in sample_plugin.cpp).
+//Bump the version whenever the layout of the struct changes.
+#define SAMPLE_PLUGIN_STATE_VERSION 1
+struct sample_plugin_state
 {
-
+    int32 print_count;
 };
-*/
\ No newline at end of file
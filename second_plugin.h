@@ -14,6 +14,8 @@ struct second_plugin_api
     SP_API_FUNCTION(void, my_second_print, () );
 
 };
+//Lets client code use the typed sp_get_api<second_plugin_api>()
+SP_DECLARE_API(second_plugin_api);
 
 /*FUTURE RELEASE
 //Keep any global or heap allocated state here, this can be used if we want to transfer
@@ -38,12 +38,22 @@ int main()
     SPlugin *plugin = sp_load_plugin(second_plugin, !reloadable);
     second_plugin_api *second_api = (second_plugin_api*)sp_get_api(plugin);
     second_api->my_second_print();
-    
+
+    //A handle to the plugin can be kept instead of the pointer, it resolves to nullptr once the plugin is unloaded.
+    SPluginHandle plugin_handle = sp_get_plugin_handle(plugin);
+
     //If we know we are done with a plugin, we can unload it manually. Otherwise leave it for the library to clean up at shutdown time.
     sp_unload_plugin(plugin);
+    SP_Assert(!sp_get_plugin(plugin_handle));
     //We can also unload it trough the API name
     sp_unload_plugin(SAMPLE_PLUGIN_API_NAME);
 
+    //Many plugins can be loaded with one call, they are loaded in parallel and registered in the order they are given.
+    char* plugin_names[] = {sample_plugin, second_plugin};
+    sp_load_plugins(plugin_names, 2, SP_LOAD_RELOADABLE);
+    sp_unload_plugin(SAMPLE_PLUGIN_API_NAME);
+    sp_unload_plugin(SECOND_PLUGIN_API_NAME);
+
     //
     //Using our registry
     //
@@ -70,6 +80,13 @@ int main()
 
     sp_registry_destroy(&my_registry);
 
+    //A registry can also keep all of its bookkeeping in a block of memory we own, instead of the heap.
+    static uint8 registry_memory[KiloBytes(64)];
+    APIRegistry arena_registry = sp_registry_create(10, registry_memory, sizeof(registry_memory));
+    sp_load_plugin(&arena_registry, second_plugin, !reloadable);
+    printf("Arena registry is using %llu bytes\n", sp_registry_memory_used(&arena_registry));
+    sp_registry_destroy(&arena_registry);
+
 
     //
     //Hot Reloading
@@ -77,17 +94,44 @@ int main()
     
     //Let's load up the sample_plugin again to demonstrate hot-reloading
     sp_load_plugin(sample_plugin, reloadable);
-    sample_api = (sample_plugin_api*)sp_get_api(SAMPLE_PLUGIN_API_NAME);
+    //The typed version hashes the api name at compile time and does not need a cast.
+    sample_api = sp_get_api<sample_plugin_api>();
     sample_api->my_print();
+    //An sp_api_ref only looks the api up again when something was loaded, unloaded or reloaded since its last use,
+    //and it becomes nullptr if the plugin is unloaded.
+    sp_api_ref<sample_plugin_api> sample_ref;
+    uint64 generation = sp_get_generation();
     
     while(1)
     {
         Sleep(100);
         //Run the registry update, it will check all reloadable plugins for changes.
+        //To give it a fixed slice of a frame instead, use sp_update_budgeted(budget_in_microseconds).
         sp_update(); 
-        //We need to get the api again in case the plugin has been modified
-        sample_plugin_api *sample_api = (sample_plugin_api*)sp_get_api(SAMPLE_PLUGIN_API_NAME);
-        sample_api->my_print();
+
+        //Anything we built from the APIs only needs to be looked at again when the generation changed.
+        if(sp_get_generation() != generation)
+        {
+            generation = sp_get_generation();
+            //The API struct is owned by the registry and a reloaded plugin fills in the same struct, unless the new
+            //version changed its size. Then the old struct is freed, so a kept pointer is asked for again here.
+            sample_api = sp_get_api<sample_plugin_api>();
+            SPlugin *reloaded[8];
+            uint32 reloaded_count = sp_get_reloaded_plugins(reloaded, 8);
+            for(uint32 index = 0; index < reloaded_count && index < 8; ++index)
+            {
+                printf("Plugin reloaded, it is now on version %u\n", reloaded[index]->reload_count);
+            }
+        }
+
+        if(sample_api)
+        {
+            sample_api->my_print();
+        }
+        if(sample_ref)
+        {
+            sample_ref->my_add_and_print(2, 3);
+        }
         
 
         //More code here...
@@ -20,8 +20,6 @@
 // Todo List :
 // 
 //  - Support for differnt OS.  
-//  - Be able to inform the user exactly which plugin has been modified when hot-reloading.
-//  - Make so that pointers to plugins do NOT become invalid when the plugin is hot reloaded.
 //  - Make it so that we can specify if a the registry is dynamic or static.
 //  - Be able to specify the hash function used.
 //  
@@ -52,6 +50,9 @@
 //              you must cast this pointer to the appropriate type that represents the API struct
 //              you are requesting, this information can be found in the plugin header.           
 //
+// or use    sp_get_api<api_struct_name>() which returns the API already typed, the api name is hashed at compile time.
+// or keep  sp_api_ref<api_struct_name> which only looks the API up again when something was loaded, unloaded or reloaded.
+//
 // FOR A COMPLETE EXAMPLE, CHECK OUT simple_plugin.cpp where there is a small but comprehensive
 // program that shows how to use the library
 //
@@ -103,10 +104,16 @@
 // API  : API reference can be found further down.
 //         [User Defines]
 //         [Loading a plugin]
+//         [Plugin Handles]
 //         [Unloading a plugin]
 //         [Querying for an API / Getting an API]
 //         [Hot Reloading Plugins]
+//         [Plugin State]
+//         [Using plugins from other threads]
+//         [Stats]
+//         [Tracing]
 //         [Creating another API registry and destroying it]  
+//         [Registry Memory]
 //===============================================================================  
 
 
@@ -137,12 +144,49 @@ typedef int32 bool32;
 #define InvalidCodePath SP_Assert(!"InvalidCodePath")
 #define InvalidDefaultCase default: {InvalidCodePath;} break
 
+// [INTERNAL] API Keys
+//An sp_api_key holds the hash of an API name. When the name is known at compile time (ex: the name of the api struct)
+//the hash is computed by the compiler, so looking up an API by key does no string work at runtime.
+struct sp_api_key
+{
+    uint64 hash;
+};
+
+// djb2 Taken from  "http://www.cse.yorku.ca/~oz/hash.html"
+//constexpr version of sp_internal_djb2_hash, both MUST give the same result.
+constexpr uint32
+sp_internal_djb2_hash_const(const char* str, uint32 hash = 5381)
+{
+    return(*str ? sp_internal_djb2_hash_const(str + 1, (uint32)(hash * 33u + (uint32)*str)) : hash);
+}
+
+//Used as a template argument to force the hash to be computed at compile time.
+template<uint32 hash_value>
+struct sp_internal_const_hash
+{
+    static const uint32 value = hash_value;
+};
+
+//Specialized for every api struct by SP_DECLARE_API, this is what lets sp_get_api<api_struct_name>() find the key.
+template<typename api_struct>
+struct sp_api_traits;
+
+#define SP_API_KEY(api_struct_name) (sp_api_key{sp_internal_const_hash<sp_internal_djb2_hash_const(#api_struct_name)>::value})
+#define SP_DECLARE_API(api_struct_name) template<> struct sp_api_traits<api_struct_name> { static const uint32 hash = sp_internal_const_hash<sp_internal_djb2_hash_const(#api_struct_name)>::value; }
+
 //@NOTE: Helper macros to be used in the creation of plugins
 #define SP_CREATE_API(api_struct_name) internal api_struct_name api_struct_name = {}
 #define SP_INIT_API_FUNC_PTR(api_struct_name,function_name) api_struct_name.function_name = function_name 
-#define SP_REGISTER_API(reg,api_struct_name,reload) reg->add(#api_struct_name,&api_struct_name,reload, reg)
-#define SP_REMOVE_API(reg, api_struct_name, reload) reg->remove(#api_struct_name, reload,reg);
+//@NOTE: A reload that changes the size of the api struct gives it a new struct in the registry and frees the old one,
+//so the host has to get the API again (See sp_get_api).
+#define SP_REGISTER_API(reg,api_struct_name,reload) reg->add(SP_API_KEY(api_struct_name),&api_struct_name,sizeof(api_struct_name),reload, reg)
+#define SP_REMOVE_API(reg, api_struct_name, reload) reg->remove(SP_API_KEY(api_struct_name), reload,reg);
 #define SP_API_FUNCTION(return_type, function_name, params) return_type (*function_name) params 
+#define SP_GET_STATE(reg, api_struct_name, state_struct_name, version, migrate) (state_struct_name*)reg->state(SP_API_KEY(api_struct_name), sizeof(state_struct_name), version, migrate, reg)
+
+//Called by SP_GET_STATE when the version or the size of a plugin state changed across a reload.
+//new_state is zeroed, old_state is freed once the old version of the plugin has been unloaded.
+typedef void (*sp_state_migrate_func)(void *old_state, uint32 old_size, uint32 old_version, void *new_state, uint32 new_size);
 
 //SP_EXPORT
 #ifdef _WIN32
@@ -163,6 +207,18 @@ typedef int32 bool32;
 //API registry -- idea taken from "http://ourmachinery.com/post/little-machines-working-together-part-1/"
 //forward declare
 struct SPlugin;
+struct SPluginHandle;
+struct SPIndexEntry;
+struct SPWatcher;
+struct SPReloadJob;
+struct SPReadView;
+struct SPReaders;
+struct SPReader;
+struct SPTrampolineBlock;
+struct SPTrampolineRun;
+struct SPLoadBatch;
+struct SPLazyPlugin;
+struct SPPluginState;
 struct APIRegistry;
 
 
@@ -176,8 +232,48 @@ struct APIRegistry;
 #define SP_REGISTRY_INITIAL_CAPACITY 10
 //Growth factor for the apiregistry
 #define SP_REGISTRY_GROWTH_FACTOR    2
-//Maximum number of reloadable plugins that the registry can have
-#define SP_MAX_RELOADABLE_PLUGINS 100
+//Number of plugins per storage chunk. The registry grows by adding chunks so plugins never move in memory.
+#define SP_REGISTRY_CHUNK_SIZE       16
+//When less than this percent of the registry is in use after a plugin is unloaded, the empty chunks at the end are freed.
+#define SP_REGISTRY_COMPACT_PERCENT  25
+//Maximum load factor (in percent) of the api_hash index. Tombstones count towards the load, when it is reached the
+//tombstones are dropped, and the index only doubles if the live entries alone fill more than half of it.
+#define SP_REGISTRY_INDEX_MAX_LOAD 50
+//Define this to give every thread a small cache of the APIs it looked up, so sp_get_api on other threads does not touch
+//the registry while it is being updated. Without it every sp_get_api probes the read view of the registry, which is
+//faster with few threads (measure with bench_thread_cache.cpp before turning it on).
+//#define SP_ENABLE_THREAD_CACHE
+//Number of entries of the thread cache per thread, must be a power of two.
+#define SP_THREAD_CACHE_SIZE 32
+//Define this to go back to asking every reloadable plugin for its last write time on every sp_update,
+//instead of being notified by the OS when the plugin directories change.
+//#define SP_DISABLE_FILE_WATCHER
+//Define this to prepare reloads on a worker thread. Copying the plugin, loading it and resolving its symbols is done
+//in the background and a later sp_update only swaps in the new version, so big plugins do not stall the main thread.
+//#define SP_ASYNC_RELOAD
+//Define this to make the function pointers in the API structs point at trampolines owned by the registry (x86/x64 only).
+//A trampoline is a single indirect jump to the current version of the function, so a function pointer copied out of an
+//API struct (ex: my_table.print = sample_api->my_print) stays valid across hot reloads.
+//The API struct must only contain function pointers. Costs one extra indirect jump per call.
+//#define SP_API_TRAMPOLINES
+//Default time (in milliseconds) that the file of a reloadable plugin has to stay unchanged before it is reloaded.
+//Compilers and linkers write a plugin in several steps, waiting for the file to settle avoids reloading half written files.
+//Can be changed per plugin with sp_set_reload_debounce, 0 reloads as soon as a change is seen.
+#define SP_RELOAD_DEBOUNCE_MS 100
+//Define this to keep performance counters for the registry and for every plugin, see [Stats].
+//Every sp_get_api does an atomic increment when this is defined.
+//#define SP_ENABLE_STATS
+//Define this to be able to record a timeline of loads, reloads and updates, see [Tracing].
+//#define SP_ENABLE_TRACE
+//Number of events each thread can hold before the oldest ones are overwritten, must be a power of two.
+#define SP_TRACE_BUFFER_EVENTS 4096
+//Maximum number of threads that can record events.
+#define SP_TRACE_MAX_THREADS 64
+//Define this to keep the temp copies that reloadable plugins are loaded from, instead of deleting them when they are
+//freed. Profilers that look up symbols by module path after the fact can then still find every version.
+//@NOTE: Every reload leaves one more copy on disk, they pile up until the next time that plugin is loaded, which
+//deletes them.
+//#define SP_KEEP_MODULE_COPIES
 
 //=============================================================================
 // API - [Loading a plugin]
@@ -196,8 +292,9 @@ struct APIRegistry;
 //not necessary to keep this pointer as there are other functions available to query a plugin's API.
 //
 // *** ATTENTION ***
-// At the moment it is NOT advisable to keep direct pointers to plugins that will be hot-reloaded as these pointers
-// may become invalid once the plugin is hot-reload by the library. This might be fixed in the future. @TODO.
+// The plugin pointer stays valid when the registry grows and when the plugin is hot-reloaded, but NOT after the plugin
+// is unloaded (the slot will be reused by the next plugin that is loaded). If you need to hold on to a plugin that might be
+// unloaded, keep an SPluginHandle instead (see [Plugin Handles] below).
 SPlugin * sp_load_plugin(char* plugin_name, bool32 reloadable);
 
 //This function is the same as the one above, however in here we can pass in a pointer to a APIRegistry that we have created.
@@ -205,6 +302,75 @@ SPlugin * sp_load_plugin(char* plugin_name, bool32 reloadable);
 //For an example of this, please refer to the simple_plugin.cpp file.
 SPlugin * sp_load_plugin(APIRegistry *registry, char* plugin_name, bool32 reloadable);
 
+//Flags for sp_load_plugins, they apply to every plugin in the batch.
+#define SP_LOAD_RELOADABLE 0x1
+
+//Used to load many plugins at once, ex: at startup.
+//The plugins are copied, loaded by the OS and have their symbols resolved in parallel on the thread pool.
+//Then they are registered (their load function is called) one by one, in the order of plugin_names, on the calling thread.
+//plugin_names - names of the plugins to load
+//count - number of names in plugin_names
+//flags - SP_LOAD_ flags
+//plugins - (optional) array of count pointers that receives the loaded plugins, nullptr for the ones that failed to load
+//
+//Returns the number of plugins that were loaded.
+uint32 sp_load_plugins(char** plugin_names, uint32 count, uint32 flags, SPlugin** plugins = nullptr);
+uint32 sp_load_plugins(APIRegistry *registry, char** plugin_names, uint32 count, uint32 flags, SPlugin** plugins = nullptr);
+
+//Same as above, but returns right away with a handle to the batch while the plugins are loaded in the background.
+//The plugin names must stay valid until the batch is finished.
+SPLoadBatch * sp_load_plugins_async(char** plugin_names, uint32 count, uint32 flags);
+SPLoadBatch * sp_load_plugins_async(APIRegistry *registry, char** plugin_names, uint32 count, uint32 flags);
+
+//Returns true once every plugin in the batch is ready to be registered, sp_load_batch_finish will then not block.
+bool32 sp_load_batch_ready(SPLoadBatch *batch);
+
+//Waits for the batch and registers its plugins in order, this must be called from the thread that owns the registry.
+//The batch handle is freed, it must not be used after this call.
+//plugins - (optional) same as in sp_load_plugins
+//
+//Returns the number of plugins that were loaded.
+uint32 sp_load_batch_finish(SPLoadBatch *batch, SPlugin** plugins = nullptr);
+
+//Registers a plugin without loading it, the plugin is loaded by the first sp_get_api that asks for its API.
+//This way a process does not pay (startup time and memory) for the plugins it never uses.
+//Once loaded it is the same as a plugin loaded with sp_load_plugin, and looking up its API costs the same.
+//plugin_name - specifies name of the plugin
+//api_name    - name of the API the plugin registers (convention is PLUGIN_NAME_API_NAME)
+//reloadable  - same as sp_load_plugin
+//
+// *** ATTENTION ***
+// Only sp_get_api on the thread that created the registry loads a lazy plugin, on other threads it returns nullptr
+// until the plugin is loaded.
+void sp_load_plugin_lazy(char* plugin_name, char* api_name, bool32 reloadable);
+void sp_load_plugin_lazy(APIRegistry *registry, char* plugin_name, char* api_name, bool32 reloadable);
+
+//=============================================================================
+// API - [Plugin Handles]
+//
+//=============================================================================
+
+//A handle is the index of the plugin slot in the registry plus the generation of that slot.
+//The generation is bumped every time a slot is freed, so a handle to an unloaded plugin is detected as stale
+//instead of silently pointing at whatever plugin was loaded into the slot afterwards.
+//A zeroed handle is never valid.
+struct SPluginHandle
+{
+    uint32 index;
+    uint32 generation;
+};
+
+//Returns the handle for a plugin returned by sp_load_plugin.
+SPluginHandle sp_get_plugin_handle(SPlugin *plugin);
+
+//Resolves a handle in O(1), returns nullptr if the handle is stale (the plugin was unloaded).
+//Unlike sp_get_api, this should only be called from the thread that owns the registry.
+//registry - the registry to which the plugin belongs too.
+SPlugin * sp_get_plugin(APIRegistry *registry, SPluginHandle handle);
+
+//Same as above but for the default registry.
+SPlugin * sp_get_plugin(SPluginHandle handle);
+
 //=============================================================================
 // API - [Unloading a plugin]
 //
@@ -246,6 +412,14 @@ void sp_unload_plugin(SPlugin *plugin);
 //We have to cast this pointer to the appropriate struct type so we can use the API provided by a plugin.
 //All this is available in the plugins header.
 //
+//The API struct lives in memory owned by the registry, when a plugin is hot-reloaded the new version fills in the
+//same struct. So the pointer can be kept and used after sp_update(), it only becomes invalid once the plugin is unloaded
+//or when the new version changed the size of the API struct (ex: added a function), the API then gets a new struct
+//and the old one is freed, so a kept pointer would dangle.
+//Ask for the API again whenever sp_get_generation() changed (a size change always bumps it), or use sp_api_ref which
+//does this on its own.
+//Function pointers copied out of the struct still point into the old module after a reload, unless SP_API_TRAMPOLINES is defined.
+//
 //plugin - pointer to a SPlugin 
 void * sp_get_api(SPlugin *plugin);
 
@@ -261,6 +435,82 @@ void * sp_get_api(APIRegistry *registry,SPlugin *plugin);
 //
 void * sp_get_api(APIRegistry *registry,char *api_name);
 
+//These take a key that was hashed at compile time, use SP_API_KEY(api_struct_name) to make one.
+//Prefer these (or the typed versions below) over the char* versions when calling every frame, since no hashing is done.
+void * sp_get_api(sp_api_key api_key);
+
+//
+void * sp_get_api(APIRegistry *registry,sp_api_key api_key);
+
+//Typed versions, the key comes from the api struct type so there is no string work at runtime and no cast is needed.
+//The plugin header must have SP_DECLARE_API(api_struct_name) after the api struct declaration.
+//
+//  sample_plugin_api *sample_api = sp_get_api<sample_plugin_api>();
+template<typename api_struct>
+inline api_struct * sp_get_api(APIRegistry *registry)
+{
+    return((api_struct*)sp_get_api(registry, sp_api_key{sp_api_traits<api_struct>::hash}));
+}
+
+//
+template<typename api_struct>
+inline api_struct * sp_get_api()
+{
+    return((api_struct*)sp_get_api(sp_api_key{sp_api_traits<api_struct>::hash}));
+}
+
+//[INTERNAL] Used by sp_api_ref.
+void * sp_internal_api_ref_resolve(APIRegistry *registry, sp_api_key api_key, const volatile int64 **generation_word, int64 *generation);
+
+inline const volatile int64 *
+sp_internal_api_ref_stale_generation()
+{
+    local_persist const volatile int64 stale = -1; //registry generations start at 0, so this never matches
+    return(&stale);
+}
+
+//A reference to an API that looks it up again only when the registry generation changed (See sp_get_generation).
+//Using it costs one compare when nothing changed, and it follows the API when it is unloaded (becomes nullptr) or loaded again.
+//Can be kept as a global or a member, the API is looked up on first use.
+//
+//  sp_api_ref<sample_plugin_api> sample_api;
+//  sample_api->my_print();
+//  if(sample_api) ...
+//
+//registry - registry to look the API up in, nullptr uses the default one.
+template<typename api_struct>
+struct sp_api_ref
+{
+    APIRegistry *registry;
+    api_struct *api;
+    const volatile int64 *generation_word; //generation of the registry, once it has been resolved
+    int64 generation;                      //generation api was looked up in
+
+    sp_api_ref(APIRegistry *registry = nullptr)
+        : registry(registry), api(nullptr), generation_word(sp_internal_api_ref_stale_generation()), generation(0)
+    {
+    }
+
+    api_struct * get()
+    {
+        if(*generation_word != generation)
+        {
+            api = (api_struct*)sp_internal_api_ref_resolve(registry, sp_api_key{sp_api_traits<api_struct>::hash}, &generation_word, &generation);
+        }
+        return(api);
+    }
+
+    api_struct * operator->()
+    {
+        return(get());
+    }
+
+    explicit operator bool()
+    {
+        return(get() != nullptr);
+    }
+};
+
 
 //=============================================================================
 // API - [Hot Reloading Plugins]
@@ -271,19 +521,187 @@ void * sp_get_api(APIRegistry *registry,char *api_name);
 //If any of these plugins have been changed then the library is in charge of loading the new version, unloading the old version
 //and registring thhe new version appropriatly.
 //
+//The registry watches the directories of the reloadable plugins, so when nothing has changed this does not make any syscalls.
+//Only plugins whose file was written to are checked. (See SP_DISABLE_FILE_WATCHER)
+//
+//A modified plugin is only reloaded once its file has stopped changing for its debounce time (See SP_RELOAD_DEBOUNCE_MS).
+//Plugins that change together (ex: one build) are reloaded together, in the same sp_update, once all of them have settled.
+//
+//With SP_ASYNC_RELOAD defined a modified plugin is prepared on a worker thread and swapped in by the first sp_update
+//after it is ready, so the new version shows up one or more calls after the change is detected.
+//
 //***ATTENTION***
-// - Any pointers that you might have had that point directly to a plugin might become invalid for hot-reloadable plugins 
-// - While the library is in charge of monitoring the plugin, loading the new one and unloading the old version, the USER
-//   is responsible for getting the API from the new version.
+// - Pointers and handles to a plugin stay valid when it is hot-reloaded, the new version takes over the slot of the old one.
+// - API pointers returned by sp_get_api stay valid too, the new version fills in the same API struct (unless it changed size).
 // - Check the simple_plugin.cpp file for more details.
 //
-//The return type is a bool32 that indicated whether any plugins have changed, tho at the moment the library does not specify which one. @TODO
+//The return type is a bool32 that indicated whether any plugins have changed, sp_get_reloaded_plugins tells which ones.
 bool32 sp_update();
 
 //Same as above but instead of updating the default registry we update the given registry
 //registry - a user specified registry
 bool32 sp_update(APIRegistry *registry);
 
+//Same as sp_update, but tries to return within budget_us microseconds so it can be given a fixed slice of a frame.
+//Reloadable plugins that have to be polled are checked round robin, a call checks as many as fit and the next call
+//carries on from there. Reloads that do not fit (going by how long their last reload took) are left for the next call.
+//The first reload of a call always runs, so a plugin that takes longer than the whole budget still gets reloaded.
+//registry    - registry to update, nullptr updates the default one
+//budget_us   - time the call should take at most, in microseconds
+//outstanding - if not nullptr, receives how much work is left: plugins not yet checked in this round and plugins
+//              waiting to be reloaded (still settling, deferred or being prepared with SP_ASYNC_RELOAD)
+//Returns whether any plugin was reloaded, like sp_update.
+bool32 sp_update_budgeted(APIRegistry *registry, uint32 budget_us, uint32 *outstanding = nullptr);
+bool32 sp_update_budgeted(uint32 budget_us, uint32 *outstanding = nullptr);
+
+//Sets how long (in milliseconds) the file of a reloadable plugin has to stay unchanged before sp_update reloads it.
+//plugin - pointer to a reloadable SPlugin
+//milliseconds - debounce time, 0 reloads as soon as a change is seen
+void sp_set_reload_debounce(SPlugin *plugin, uint32 milliseconds);
+
+//Fills in the plugins that were reloaded by the last sp_update, in the order they were reloaded.
+//plugins     - array that receives the plugins, can be nullptr to only get the count
+//max_plugins - size of the plugins array
+//Returns how many plugins were reloaded, which can be more than max_plugins.
+//The plugins stay in the list until the next sp_update or until they are unloaded.
+uint32 sp_get_reloaded_plugins(SPlugin **plugins, uint32 max_plugins);
+uint32 sp_get_reloaded_plugins(APIRegistry *registry, SPlugin **plugins, uint32 max_plugins);
+
+//Every registry has a generation number that goes up each time APIs are added, removed or reloaded, and every
+//plugin remembers the registry generation in which its API last changed.
+//If the generation is the same as the last time it was checked nothing has changed, so a host that keeps things
+//derived from the APIs can skip refreshing them on frames where nothing happened (nearly all of them).
+//The generation is only bumped once the change can be seen by sp_get_api, it can be read from any thread.
+uint64 sp_get_generation();
+uint64 sp_get_generation(APIRegistry *registry);
+uint64 sp_get_api_generation(SPlugin *plugin);
+
+//=============================================================================
+// API - [Plugin State]
+//
+//=============================================================================
+
+//A plugin can ask the registry for a block of memory to keep its state in, from its load function:
+//
+//  state = SP_GET_STATE(reg, sample_plugin_api, sample_plugin_state, SAMPLE_PLUGIN_STATE_VERSION, migrate_function);
+//
+//The block is owned by the registry and belongs to the API, it is zeroed the first time it is asked for.
+//When the plugin is hot-reloaded the new version gets the same block back, nothing is copied and nothing has to be rebuilt.
+//If the version or the size of the state changed, the new version gets a new zeroed block and migrate_function (can be nullptr)
+//is called to fill it in from the old one. The old block stays valid until the old version has been unloaded.
+//The block is freed when the plugin is unloaded.
+//Check the sample_plugin.h and sample_plugin.cpp files for an example.
+
+//=============================================================================
+// API - [Using plugins from other threads]
+//
+//=============================================================================
+
+//sp_get_api can be called from any thread, even while the thread that owns the registry is in sp_update or is loading
+//or unloading plugins. Lookups never take a lock or wait.
+//What the library needs to know is when other threads can no longer be running code from (or holding pointers into) an
+//old version of a plugin, so that it can be freed. For that, threads that use plugin APIs register as readers and call
+//sp_reader_quiescent at points where they are not in the middle of using a plugin, for example between two jobs.
+//Old modules and old registry memory are only freed after every registered reader has passed a quiescent point.
+//
+//***ATTENTION***
+// - Only one thread, the one that calls sp_update, should load, unload and update plugins.
+// - API struct pointers can still be kept across quiescent points, they are valid until the plugin is unloaded.
+// - A reader that never calls sp_reader_quiescent keeps old modules loaded, unregister threads once they are done.
+// - Unregistered threads must not use plugin APIs while the registry is being updated.
+//
+//With SP_ENABLE_THREAD_CACHE every thread keeps the APIs it looked up in a small cache of its own, it is thrown away when
+//any registry publishes a change. So while nothing changes, lookups on other threads only read thread local memory and
+//one shared counter that the owner thread does not write during sp_update.
+
+//Registers the calling thread as a reader of the given registry.
+SPReader * sp_reader_register(APIRegistry *registry);
+
+//Same as above, for the default registry.
+SPReader * sp_reader_register();
+
+//Tells the registry this reader is not using anything it got from a plugin (other than API struct pointers).
+//This is cheap, it is meant to be called often.
+void sp_reader_quiescent(SPReader *reader);
+
+//The reader will no longer use the registry, it does not hold back freeing old modules anymore.
+void sp_reader_unregister(SPReader *reader);
+
+//=============================================================================
+// API - [Stats]
+//
+//=============================================================================
+//Only available when SP_ENABLE_STATS is defined. All times are in microseconds.
+#ifdef SP_ENABLE_STATS
+
+//Counters of one plugin. The last_* times of a reload are split in the steps of the reload.
+struct SPPluginStats
+{
+    uint64 api_hash;
+    SPluginHandle handle;
+
+    int64 load_us;           //first load, all steps
+    uint64 lookups;          //sp_get_api calls that returned this plugin's API
+
+    uint32 reload_count;
+    uint32 failed_reloads;
+    int64 last_copy_us;      //copy the plugin file
+    int64 last_map_us;       //LoadLibrary
+    int64 last_resolve_us;   //find the load/unload functions
+    int64 last_load_call_us; //the plugin's load and unload functions
+    int64 last_reload_us;    //all of the above
+    int64 max_reload_us;
+    int64 total_reload_us;
+    //Time the thread calling sp_update was blocked by the last reload. With SP_ASYNC_RELOAD this is only the swap.
+    int64 last_stall_us;
+    int64 max_stall_us;
+};
+
+struct SPRegistryStats
+{
+    uint32 plugin_count;
+    uint64 failed_lookups;   //sp_get_api calls that returned nullptr
+    uint64 update_count;     //sp_update calls
+    int64 last_update_us;
+    int64 max_update_us;
+    int64 total_update_us;
+};
+
+//Takes a snapshot of the counters, cheap enough to call every frame.
+//registry_stats - (optional) receives the counters of the registry
+//plugin_stats - (optional) array that receives the counters of each loaded plugin
+//max_plugin_stats - size of plugin_stats
+//
+//Returns the number of plugins written to plugin_stats.
+uint32 sp_get_stats(APIRegistry *registry, SPRegistryStats *registry_stats, SPPluginStats *plugin_stats, uint32 max_plugin_stats);
+
+//Same as above, for the default registry.
+uint32 sp_get_stats(SPRegistryStats *registry_stats, SPPluginStats *plugin_stats, uint32 max_plugin_stats);
+#endif //SP_ENABLE_STATS
+
+//=============================================================================
+// API - [Tracing]
+//
+//=============================================================================
+//Only available when SP_ENABLE_TRACE is defined.
+//While tracing, the library records when each step of loading, reloading and updating begins and ends. The events can be
+//written to a Chrome trace file (JSON) that can be opened in chrome://tracing or ui.perfetto.dev.
+//Every thread records into its own ring buffer, recording does not allocate and does not take locks.
+#ifdef SP_ENABLE_TRACE
+
+//Starts recording events. The ring buffers are allocated by the first call.
+void sp_trace_start();
+
+//Stops recording events, the events that were recorded can still be flushed.
+void sp_trace_stop();
+
+//Writes the events recorded since the last flush to file_name as a Chrome trace.
+//Events from threads that are still recording are written too, events that are overwritten while the flush reads them
+//are skipped.
+//Returns false if the file could not be written.
+bool32 sp_trace_flush(char *file_name);
+#endif //SP_ENABLE_TRACE
+
 //=============================================================================
 // API - [Creating another API registry and destroying it]
 //
@@ -299,26 +717,128 @@ APIRegistry sp_registry_create(uint32 capacity);
 
 //This function is used to destroy a user created registry.
 //All plugins will be removed from the registry, all plugins will call their unload function and any file or library handles will be cleaned up.
+//Reader threads must be done with the registry before it is destroyed.
 void sp_registry_destroy(APIRegistry *registry);
 //
 
+//=============================================================================
+// API - [Registry Memory]
+//
+//=============================================================================
+
+//All the bookkeeping of a registry (plugin storage, index, read views, API structs, watcher, reload jobs...) is
+//allocated trough the allocator the registry was created with. Plugin code and the loaded modules are not.
+//
+//reallocate works like realloc with the sizes passed in: ptr nullptr allocates new_size bytes, new_size 0 frees ptr.
+//old_size is the size ptr was allocated with. The memory returned must be 16 byte aligned.
+//It is only called from the thread that owns the registry (the one that created it).
+struct SPAllocator
+{
+    void *user_data;
+    void* (*reallocate)(void *user_data, void *ptr, uint64 old_size, uint64 new_size);
+};
+
+//Creates a registry that allocates trough allocator.
+APIRegistry sp_registry_create(uint32 capacity, SPAllocator allocator);
+
+//Creates a registry that keeps all of its bookkeeping inside memory, nothing is allocated from the heap.
+//memory must stay valid until the registry is destroyed. The registry asserts if memory is too small,
+//sp_registry_memory_used can be used to find the size a set of plugins needs.
+APIRegistry sp_registry_create(uint32 capacity, void *memory, uint64 memory_size);
+
+//Sets the allocator used by the default registry and by sp_registry_create(capacity).
+//The default registry is created the first time it is used, so this has to be called before that.
+void sp_set_default_allocator(SPAllocator allocator);
+
+//Returns the bytes the registry currently has allocated, peak is filled in with the most it ever had.
+//Without a registry it reports on the default one.
+uint64 sp_registry_memory_used(APIRegistry *registry = nullptr, uint64 *peak = nullptr);
+
 
 struct APIRegistry
 {
     int32 capacity;
     int32 used;
 
-    SPlugin *plugins;
-
-    SPlugin *reloadable_plugins[SP_MAX_RELOADABLE_PLUGINS];
-    uint16 reloadable_count;
-    //Some helpers to speed up lookup of plugins and "holes".
-    SPlugin *curr;
-    int32 next_hole_index;
-
-    void (*add)(char* plugin_name, void* api, bool32 reload, APIRegistry* registry);
-    void (*remove)(char* plugin_name, bool32 reload, APIRegistry *registry);
+    //Plugins are stored in fixed size chunks (SP_REGISTRY_CHUNK_SIZE), growing only adds chunks so plugins never move.
+    SPlugin **plugin_chunks;
+    uint32 chunk_count;
+    //Hot part of every slot (indexed like the slots), kept apart from the SPlugin records so that
+    //publishing the read view and scanning for free slots only walk dense arrays.
+    uint64 *plugin_api_hashes;
+    void **plugin_apis;
+
+    //Reloadable plugins, in no particular order (removing one moves the last one into its place).
+    SPlugin **reloadable_plugins;
+    uint32 reloadable_count;
+    uint32 reloadable_capacity;
+    uint32 poll_cursor; //next reloadable plugin to poll, sp_update_budgeted polls round robin
+    uint32 reload_cursor; //first reloadable plugin whose reload was deferred by a deadline, the next batch starts there
+    //Directories of the reloadable plugins that we get change notifications for, nullptr until a reloadable plugin is loaded.
+    SPWatcher *watcher;
+    bool32 reload_pending; //at least one reloadable plugin is waiting for its file to settle
+    //Reloads being prepared on a worker thread (SP_ASYNC_RELOAD).
+    SPReloadJob **pending_reloads;
+    uint32 pending_reload_count;
+    uint32 pending_reload_capacity;
+    //Free slots, one bit per slot (set means free). The lowest free slot is always the next one used.
+    uint32 *free_slots;
+    uint32 free_hint;           //no free slot in the words below this one
+    uint32 min_chunk_count;     //chunks for the capacity the registry was created with, never compacted away
+    uint32 released_generation; //highest generation of the slots in chunks that were freed by compaction
+
+    //Open addressing index (api_hash -> plugin slot), so lookups do not depend on capacity.
+    //Only used by the thread that owns the registry.
+    SPIndexEntry *index;
+    uint32 index_capacity; //always a power of two
+    uint32 index_used;     //live entries + tombstones
+    uint32 index_live;     //live entries
+
+    //Read only copy of the index (api_hash -> api) that sp_get_api uses, it is replaced as a whole when APIs are added
+    //or removed so other threads can look up APIs without locks. See [Using plugins from other threads].
+    SPReadView * volatile read_view;
+    bool32 view_dirty;
+    SPReaders *readers;
+
+    //Executable memory for the API trampolines (SP_API_TRAMPOLINES).
+    SPTrampolineBlock *trampolines;
+    SPTrampolineRun *free_trampolines; //trampolines of unloaded apis, reused before the blocks grow
+
+    //Plugins that are loaded by the first sp_get_api for their API, see sp_load_plugin_lazy.
+    SPLazyPlugin *lazy_plugins;
+    uint32 lazy_count;
+    uint32 lazy_capacity;
+    uint32 owner_thread_id; //thread that created the registry, the only one that loads lazy plugins
+    //Slot of the plugin whose load function is running, the add of that load function fills it in.
+    //Its slot is claimed before the load function runs, so a lazy plugin loaded from inside it gets another one.
+    SPlugin *loading_plugin;
+
+    //State blocks that plugins keep across reloads, see [Plugin State].
+    SPPluginState *states;
+    uint32 state_count;
+    uint32 state_capacity;
+
+    //Bumped after every publish that added, removed or reloaded an API, see sp_get_generation.
+    volatile int64 generation;
+    bool32 generation_dirty;
+    //Plugins reloaded by the last sp_update, see sp_get_reloaded_plugins.
+    SPlugin **reloaded_plugins;
+    uint32 reloaded_count;
+    uint32 reloaded_capacity;
+
+    #ifdef SP_ENABLE_STATS
+    SPRegistryStats stats;
+    #endif //SP_ENABLE_STATS
+
+    //Where the bookkeeping above is allocated from, see [Registry Memory].
+    SPAllocator allocator;
+    uint64 memory_used;
+    uint64 memory_peak;
+
+    void* (*add)(sp_api_key api_key, void* api, uint32 api_size, bool32 reload, APIRegistry* registry);
+    void (*remove)(sp_api_key api_key, bool32 reload, APIRegistry *registry);
     void* (*get)(uint64 api_hash, APIRegistry *registry);
+    void* (*state)(sp_api_key api_key, uint32 size, uint32 version, sp_state_migrate_func migrate, APIRegistry *registry);
 };
 
 //===============================================================================  
@@ -329,7 +849,10 @@ struct APIRegistry
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <winioctl.h> //block cloning, not pulled in by WIN32_LEAN_AND_MEAN
 #include <stdlib.h> //malloc, realloc
+#include <malloc.h> //_aligned_realloc
+#include <intrin.h> //_BitScanForward
 #endif //_WIN32
 
 #include <stdio.h>
@@ -494,6 +1017,22 @@ sp_string_build_tmp_name(char* plugin_name, StrBuffer *buffer, int32 count = 0)
     }
 }
 
+//Same as above but builds a wildcard that matches every temp name of the plugin (ex: plugin_temp*.dll)
+inline void
+sp_string_build_tmp_pattern(char* plugin_name, StrBuffer *buffer)
+{
+    char *c = plugin_name;
+    while(*c)
+    {
+        if(*c == '.')
+        {
+            sp_buffer_append_string(buffer, "_temp*");
+        }
+        sp_buffer_append_char(buffer, *c);
+        ++c;
+    }
+}
+
 //Given a full path to the plugin, we extract the name
 inline void 
 sp_string_extract_plugin_name(char* plugin_full_path, char* extracted_name)
@@ -523,582 +1062,3613 @@ sp_string_extract_plugin_name(char* plugin_full_path, char* extracted_name)
 
 // End String Utilities
 
-struct SPlugin
-{
-    uint64 hash;
-    uint64 api_hash;
-    uint32 reload_count;
-    bool32 reloadable;
+#if defined(_M_IX86) || defined(_M_X64)
+//Loads are not reordered with other loads (and stores with other stores) on x86/x64, we only need to stop the compiler from doing it.
+#define SP_READ_BARRIER() _ReadWriteBarrier()
+#define SP_WRITE_BARRIER() _WriteBarrier()
+#else
+#define SP_READ_BARRIER() MemoryBarrier()
+#define SP_WRITE_BARRIER() MemoryBarrier()
+#endif
 
-    void* api;
-    void* unload_func;
+// Tracing (SP_ENABLE_TRACE) ----------------------------------------------------
+//Each thread that records an event claims a ring buffer from a pool allocated by sp_trace_start, the thread is the only
+//writer of its buffer. The writer fills in the event and only then moves write_index, sp_trace_flush reads an event and
+//then checks that write_index did not move far enough to overwrite it in the meantime.
+//Names are string literals, so an event is only a few words and nothing is copied.
 
-    //Win32 Specific
-    HMODULE library_handle;
-    HANDLE file_handle;
-    FILETIME last_write_time;
+#ifdef SP_ENABLE_TRACE
 
-};
+#define SP_TRACE_BEGIN 'B'
+#define SP_TRACE_END   'E'
 
-bool32 sp_plugin_is_initialized(SPlugin* plugin)
+struct SPTraceEvent
 {
-    //Plugin should NOT be considered initialzed if any of these are Zero or null.
-    return( plugin->hash && plugin->api_hash && plugin->api);
-}
-
-//Hash Functions ----------------------------------------------------
-//@TODO: Try out MurmurHash3
-
-#define SP_HASH(string) sp_internal_djb2_hash(string)
+    const char *name;
+    int64 time_us;
+    int64 arg;
+    char phase;
+};
 
-// djb2 Taken from  "http://www.cse.yorku.ca/~oz/hash.html"
-unsigned long sp_internal_djb2_hash(char* str)
+struct SPTraceBuffer
 {
-    unsigned long hash = 5381;
-    int c;
-    while (c = *str++){
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-    }    
-    return (hash);
-}
-//End Hash Functions ----------------------------------------------------
-
-
-
-
-
-
-//Typedefs of the plugin load and unload function signatures
-typedef void (*load_func)(APIRegistry *, bool32);
-typedef void (*unload_func)(APIRegistry *, bool32);
+    volatile uint64 write_index;
+    uint64 read_index; //only used by sp_trace_flush
+    uint32 thread_id;
+    SPTraceEvent events[SP_TRACE_BUFFER_EVENTS];
+};
 
+global_variable SPTraceBuffer *sp_trace_buffers;
+global_variable volatile LONG sp_trace_buffer_count;
+global_variable volatile LONG sp_trace_enabled;
+thread_local SPTraceBuffer *sp_trace_thread_buffer;
+//Kept in sp_trace_thread_buffer by threads that found no free buffer, so they stop asking for one.
+#define SP_TRACE_NO_BUFFER ((SPTraceBuffer*)(uintptr_t)1)
 
-void sp_internal_api_registry_add(char* api_name, void* api, bool32 reload, APIRegistry *registry);
-void sp_internal_api_registry_remove(char* plugin_name, bool32 reload, APIRegistry *registry);
-void * sp_internal_api_registry_get(uint64 api_hash, APIRegistry *registry);
-void sp_internal_api_registry_transfer_state(void* old_state, void* new_sate);
+inline int64 sp_internal_win32_get_time_us();
 
+internal void
+sp_internal_trace(const char *name, char phase, int64 arg)
+{
+    if(!sp_trace_enabled)
+    {
+        return;
+    }
+    SPTraceBuffer *buffer = sp_trace_thread_buffer;
+    if(buffer == SP_TRACE_NO_BUFFER)
+    {
+        return;
+    }
+    if(!buffer)
+    {
+        LONG index = InterlockedIncrement(&sp_trace_buffer_count) - 1;
+        if(index >= SP_TRACE_MAX_THREADS)
+        {
+            sp_trace_thread_buffer = SP_TRACE_NO_BUFFER; //Out of buffers, this thread is not traced.
+            return;
+        }
+        buffer = &sp_trace_buffers[index];
+        buffer->thread_id = GetCurrentThreadId();
+        sp_trace_thread_buffer = buffer;
+    }
 
+    uint64 write_index = buffer->write_index;
+    SPTraceEvent *event = &buffer->events[write_index & (SP_TRACE_BUFFER_EVENTS - 1)];
+    event->name    = name;
+    event->time_us = sp_internal_win32_get_time_us();
+    event->arg     = arg;
+    event->phase   = phase;
+    SP_WRITE_BARRIER();
+    buffer->write_index = write_index + 1;
+}
 
-internal APIRegistry sp_internal_registry_create()
+//Records the begin event when it is created and the end event when it goes out of scope.
+struct SPTraceScope
 {
-    APIRegistry reg = {};
-    reg.capacity        = SP_REGISTRY_INITIAL_CAPACITY;
-    reg.used            = 0;
-    reg.plugins         = (SPlugin*)malloc(sizeof(SPlugin) * reg.capacity);
-    memset(reg.plugins,0,sizeof(SPlugin) * reg.capacity); //set all plugin values to zero.
-    //reg.reloadable_indexes = 0;
-    reg.reloadable_count = 0;
-    reg.curr            = reg.plugins;
-    reg.next_hole_index = 0;
-    reg.add             = sp_internal_api_registry_add;
-    reg.remove          = sp_internal_api_registry_remove;
-    reg.get             = sp_internal_api_registry_get;
-    return(reg);
-}
+    const char *name;
+    int64 arg;
+    SPTraceScope(const char *scope_name, int64 scope_arg) : name(scope_name), arg(scope_arg)
+    {
+        sp_internal_trace(name, SP_TRACE_BEGIN, arg);
+    }
+    ~SPTraceScope()
+    {
+        sp_internal_trace(name, SP_TRACE_END, arg);
+    }
+};
 
-global_variable APIRegistry sp_registry = sp_internal_registry_create();
+#define SP_TRACE_JOIN_(a, b) a##b
+#define SP_TRACE_JOIN(a, b) SP_TRACE_JOIN_(a, b)
+//name must be a string literal, arg shows up as "arg" in the trace (ex: the index of the plugin).
+#define SP_TRACE_SCOPE(name, arg) SPTraceScope SP_TRACE_JOIN(sp_trace_scope_, __LINE__)(name, (int64)(arg))
 
-APIRegistry sp_registry_create(uint32 capacity)
+void sp_trace_start()
 {
-    APIRegistry reg = {};
-    reg.capacity        = capacity;
-    reg.used            = 0;
-    reg.plugins         = (SPlugin*)malloc(sizeof(SPlugin) * reg.capacity);
-    memset(reg.plugins,0,sizeof(SPlugin) * reg.capacity); //set all plugin values to zero.
-    //reg.reloadable_indexes = 0;
-    reg.reloadable_count = 0;
-    reg.curr            = reg.plugins;
-    reg.next_hole_index = 0;
-    reg.add             = sp_internal_api_registry_add;
-    reg.remove          = sp_internal_api_registry_remove;
-    reg.get             = sp_internal_api_registry_get;
-    return(reg);
+    if(!sp_trace_buffers)
+    {
+        sp_trace_buffers = (SPTraceBuffer*)calloc(SP_TRACE_MAX_THREADS, sizeof(SPTraceBuffer));
+    }
+    InterlockedExchange(&sp_trace_enabled, 1);
 }
 
-internal APIRegistry* 
-sp_internal_registry_get()
+void sp_trace_stop()
 {
-    return (&sp_registry);
+    InterlockedExchange(&sp_trace_enabled, 0);
 }
 
-void sp_internal_api_registry_add(char* api_name, void* api, bool32 reload, APIRegistry *registry)
+bool32 sp_trace_flush(char *file_name)
 {
-    APIRegistry *reg = registry;
-    if(!reg)
+    FILE *file = fopen(file_name, "w");
+    if(!file)
     {
-        reg = sp_internal_registry_get();
+        return false;
     }
-    SPlugin *plugin = nullptr;
-
-    plugin = reg->curr;
-    plugin->api_hash = SP_HASH(api_name);
-    plugin->api = api;
-
-    reg->used++;
 
-    
-    if(reg->used < reg->capacity) 
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool32 first = true;
+    LONG buffer_count = sp_trace_buffer_count;
+    if(buffer_count > SP_TRACE_MAX_THREADS)
+    {
+        buffer_count = SP_TRACE_MAX_THREADS;
+    }
+    uint32 process_id = GetCurrentProcessId();
+    for(LONG buffer_index = 0; sp_trace_buffers && buffer_index < buffer_count; ++buffer_index)
     {
-        //@TODO: This seems unnecessary....
-        if((reg->next_hole_index - 1) < reg->used /*0 based indexes*/)
+        SPTraceBuffer *buffer = &sp_trace_buffers[buffer_index];
+        uint64 end = buffer->write_index;
+        SP_READ_BARRIER();
+        uint64 start = buffer->read_index;
+        if(end - start > SP_TRACE_BUFFER_EVENTS)
         {
-            //scan to find the next position
-            uint32 count = reg->capacity;
-            for(uint32 index = 0; index < count; ++index )
-            {
-                plugin = &reg->plugins[index];
-                if(!sp_plugin_is_initialized(plugin))
-                {
-                    reg->curr = plugin;
-                    break;
-                }
-            }
+            start = end - SP_TRACE_BUFFER_EVENTS; //The older ones were overwritten.
         }
-        else
+        for(uint64 index = start; index < end; ++index)
         {
-            reg->curr++;
+            SPTraceEvent event = buffer->events[index & (SP_TRACE_BUFFER_EVENTS - 1)];
+            SP_READ_BARRIER();
+            //The writer fills in slot write_index before it moves write_index, so once write_index is
+            //SP_TRACE_BUFFER_EVENTS past this event its slot might be half way trough being overwritten.
+            if(buffer->write_index - index >= SP_TRACE_BUFFER_EVENTS)
+            {
+                continue; //Overwritten while we were reading it.
+            }
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%u,\"tid\":%u,\"args\":{\"arg\":%lld}}",
+                    first ? "" : ",\n", event.name, event.phase, (long long)event.time_us, process_id, buffer->thread_id,
+                    (long long)event.arg);
+            first = false;
         }
+        buffer->read_index = end;
     }
+    fprintf(file, "\n]}\n");
+
+    bool32 result = !ferror(file);
+    fclose(file);
+    return(result);
 }
 
-void sp_internal_api_registry_remove_reloaded(uint64 hash, APIRegistry* registry)
-{
-    APIRegistry *reg = registry;
-    if(!reg)
-    {
-        reg = sp_internal_registry_get();
-    }
-    //@NOTE: If we are removing a plugin that was reloaded we assume there is still another one here.
+#else
+#define SP_TRACE_SCOPE(name, arg)
+#endif //SP_ENABLE_TRACE
 
-    SPlugin *plugin = reg->plugins;
-    SPlugin *first_found  = nullptr;
-    SPlugin *second_found = nullptr;
-    
-        
-    uint32 count   = reg->capacity; 
-    for(uint32 index = 0; index < count; ++index )
-    {
-        plugin = &reg->plugins[index];
-        if(hash == plugin->api_hash)
-        {
-            if(!first_found)
-            {
-                first_found = plugin;
-                continue;
-            }
-            else
-            {
-                second_found = plugin;
-            }
+// End Tracing ----------------------------------------------------
 
-            plugin = first_found->reload_count < second_found->reload_count ? first_found : second_found;
-            *plugin = {}; //reset this slot
-            reg->curr = plugin;
+//Cold part of a plugin, only loads, reloads and unloads touch it.
+//The api_hash and api of the plugin are kept by the registry in dense arrays (plugin_api_hashes, plugin_apis).
+struct SPlugin
+{
+    uint64 hash;
+    uint32 reload_count;
+    bool32 reloadable;
+
+    uint32 api_size;
+    void** trampoline_targets; //where the api trampolines jump to, nullptr if the api does not use trampolines
+    void* unload_func;
+    //While reloading, the slot of the version this one replaces, set by the add of the new version and cleared when
+    //the old version removes its api (See sp_internal_api_registry_remove_reloaded).
+    SPlugin *previous_version;
+
+    //Win32 Specific
+    HMODULE library_handle;
+    HANDLE file_handle;
+    FILETIME last_write_time;
+    int64 file_size;
+
+    //Debounced reloads, last_change_us is when the file was last seen changing.
+    int64 last_change_us;
+    int64 reload_debounce_us;
+    bool32 reload_pending;
+
+    //File watching, file_hash is the hash of the file name without the path.
+    uint64 file_hash;
+    int32 watch_dir;
+    SPlugin *next_watched; //next plugin in the same bucket of the watch table
+
+    uint32 reloadable_index; //where the plugin is in reloadable_plugins
+    int64 reload_cost_us;    //main thread time of the last reload, used to fit reloads in the budget of sp_update_budgeted
+    uint64 api_generation;   //registry generation in which the api was last added or reloaded
+
+    //Background reload (SP_ASYNC_RELOAD), nullptr until the first reload.
+    SPReloadJob *reload_job;
+
+    #ifdef SP_ENABLE_STATS
+    SPPluginStats stats; //kept across reloads
+    #endif //SP_ENABLE_STATS
+
+    //Slot bookkeeping, these survive the slot being reset.
+    uint32 index;
+    uint32 generation;
+};
+
+bool32 sp_plugin_is_initialized(APIRegistry *reg, SPlugin* plugin)
+{
+    //Plugin should NOT be considered initialzed if any of these are Zero or null.
+    return( plugin->hash && reg->plugin_api_hashes[plugin->index] && reg->plugin_apis[plugin->index]);
+}
+
+inline SPlugin *
+sp_internal_registry_slot(APIRegistry *reg, uint32 index)
+{
+    return(&reg->plugin_chunks[index / SP_REGISTRY_CHUNK_SIZE][index % SP_REGISTRY_CHUNK_SIZE]);
+}
+
+inline uint64
+sp_internal_plugin_api_hash(APIRegistry *reg, SPlugin *plugin)
+{
+    return(reg->plugin_api_hashes[plugin->index]);
+}
+
+// Slots ----------------------------------------------------
+
+internal uint32
+sp_internal_slot_find_free(APIRegistry *reg)
+{
+    uint32 word_count = (reg->capacity + 31) / 32;
+    for(uint32 word = reg->free_hint; word < word_count; ++word)
+    {
+        if(reg->free_slots[word])
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, reg->free_slots[word]);
+            reg->free_hint = word;
+            return(word * 32 + bit);
+        }
+    }
+    reg->free_hint = word_count;
+    return(reg->capacity);
+}
+
+inline void
+sp_internal_slot_claim(APIRegistry *reg, uint32 index)
+{
+    reg->free_slots[index / 32] &= ~(1u << (index % 32));
+}
+
+inline void
+sp_internal_slot_release(APIRegistry *reg, uint32 index)
+{
+    reg->free_slots[index / 32] |= (1u << (index % 32));
+    if(index / 32 < reg->free_hint)
+    {
+        reg->free_hint = index / 32;
+    }
+}
+
+inline bool32
+sp_internal_slot_is_free(APIRegistry *reg, uint32 index)
+{
+    return((reg->free_slots[index / 32] >> (index % 32)) & 1);
+}
+
+//Frees the slot, bumping the generation makes any handle to the old plugin stale.
+internal void
+sp_internal_plugin_reset(APIRegistry *reg, SPlugin *plugin)
+{
+    uint32 index      = plugin->index;
+    uint32 generation = plugin->generation + 1;
+    reg->plugin_api_hashes[index] = 0;
+    reg->plugin_apis[index]       = nullptr;
+    *plugin = {};
+    plugin->index      = index;
+    plugin->generation = generation ? generation : 1; //0 is never a valid generation
+    sp_internal_slot_release(reg, index);
+}
+
+// End Slots ----------------------------------------------------
+
+// Registry Memory ----------------------------------------------------
+
+#define SP_MEMORY_ALIGN(size) (((size) + 15) & ~(uint64)15)
+
+//Every allocation made trough a registry starts with its size, so memory_used is exact and the allocator
+//always gets the old size. 16 bytes so the memory after it keeps the alignment of the allocation.
+struct SPAllocationHeader
+{
+    uint64 size;
+    uint64 pad;
+};
+
+internal void *
+sp_internal_heap_reallocate(void *user_data, void *ptr, uint64 old_size, uint64 new_size)
+{
+    #ifdef _WIN32
+    if(!new_size)
+    {
+        _aligned_free(ptr);
+        return(nullptr);
+    }
+    return(_aligned_realloc(ptr, (size_t)new_size, 16));
+    #else
+        //@TODO: Add other OS
+        #error NO OTHER OS DEFINED
+    #endif //_WIN32
+}
+
+global_variable SPAllocator sp_default_allocator = {nullptr, sp_internal_heap_reallocate};
+
+internal void *
+sp_internal_registry_reallocate(APIRegistry *reg, void *ptr, uint64 size)
+{
+    SPAllocationHeader *header = ptr ? (SPAllocationHeader*)ptr - 1 : nullptr;
+    uint64 old_size = header ? header->size + sizeof(SPAllocationHeader) : 0;
+    uint64 new_size = size ? size + sizeof(SPAllocationHeader) : 0;
+
+    header = (SPAllocationHeader*)reg->allocator.reallocate(reg->allocator.user_data, header, old_size, new_size);
+    reg->memory_used = reg->memory_used - old_size + new_size;
+    if(!size)
+    {
+        return(nullptr);
+    }
+    if(!header)
+    {
+        SP_Assert(!"Could not allocate registry memory");
+    }
+    if(reg->memory_used > reg->memory_peak)
+    {
+        reg->memory_peak = reg->memory_used;
+    }
+    header->size = size;
+    return(header + 1);
+}
+
+inline void *
+sp_internal_registry_allocate(APIRegistry *reg, uint64 size)
+{
+    return(sp_internal_registry_reallocate(reg, nullptr, size));
+}
+
+inline void
+sp_internal_registry_free(APIRegistry *reg, void *ptr)
+{
+    if(ptr)
+    {
+        sp_internal_registry_reallocate(reg, ptr, 0);
+    }
+}
+
+//Arena that a registry created with sp_registry_create(capacity, memory, memory_size) allocates from.
+//It lives at the start of the memory block. Allocations are bumped from top, freed blocks go to a free list
+//that is sorted by address so neighbours can be merged, and a block freed at the top lowers it instead.
+struct SPArenaFreeBlock
+{
+    uint64 size;
+    SPArenaFreeBlock *next;
+};
+
+struct SPArena
+{
+    uint8 *memory;
+    uint64 size;
+    uint64 top;
+    SPArenaFreeBlock *free_blocks;
+};
+
+internal uint8 *
+sp_internal_arena_take(SPArena *arena, uint64 size)
+{
+    //First fit, the reload churn is a handful of sizes so the free list stays short.
+    for(SPArenaFreeBlock **at = &arena->free_blocks; *at; at = &(*at)->next)
+    {
+        SPArenaFreeBlock *block = *at;
+        if(block->size < size)
+        {
+            continue;
+        }
+        if(block->size > size)
+        {
+            SPArenaFreeBlock *rest = (SPArenaFreeBlock*)((uint8*)block + size);
+            rest->size = block->size - size;
+            rest->next = block->next;
+            *at = rest;
+        }
+        else
+        {
+            *at = block->next;
+        }
+        return((uint8*)block);
+    }
+
+    if(arena->top + size > arena->size)
+    {
+        return(nullptr);
+    }
+    uint8 *result = arena->memory + arena->top;
+    arena->top += size;
+    return(result);
+}
+
+internal void
+sp_internal_arena_release(SPArena *arena, uint8 *ptr, uint64 size)
+{
+    if(ptr + size == arena->memory + arena->top)
+    {
+        arena->top -= size;
+        //The last free block might end at the new top, give it back too.
+        SPArenaFreeBlock **at = &arena->free_blocks;
+        while(*at && (*at)->next)
+        {
+            at = &(*at)->next;
+        }
+        if(*at && (uint8*)*at + (*at)->size == arena->memory + arena->top)
+        {
+            arena->top -= (*at)->size;
+            *at = nullptr;
+        }
+        return;
+    }
+
+    SPArenaFreeBlock *prev = nullptr;
+    SPArenaFreeBlock *next = arena->free_blocks;
+    while(next && (uint8*)next < ptr)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    SPArenaFreeBlock *block = (SPArenaFreeBlock*)ptr;
+    block->size = size;
+    block->next = next;
+    if(next && ptr + size == (uint8*)next)
+    {
+        block->size += next->size;
+        block->next  = next->next;
+    }
+    if(prev && (uint8*)prev + prev->size == ptr)
+    {
+        prev->size += block->size;
+        prev->next  = block->next;
+    }
+    else if(prev)
+    {
+        prev->next = block;
+    }
+    else
+    {
+        arena->free_blocks = block;
+    }
+}
+
+internal void *
+sp_internal_arena_reallocate(void *user_data, void *ptr, uint64 old_size, uint64 new_size)
+{
+    SPArena *arena = (SPArena*)user_data;
+    uint8 *memory = (uint8*)ptr;
+    old_size = SP_MEMORY_ALIGN(old_size);
+    new_size = SP_MEMORY_ALIGN(new_size);
+
+    if(!memory)
+    {
+        return(new_size ? sp_internal_arena_take(arena, new_size) : nullptr);
+    }
+    if(new_size <= old_size)
+    {
+        if(new_size < old_size)
+        {
+            sp_internal_arena_release(arena, memory + new_size, old_size - new_size);
+        }
+        return(new_size ? memory : nullptr);
+    }
+    //Growing the block at the top (ex: the index or the chunk array) does not need a copy.
+    if(memory + old_size == arena->memory + arena->top && arena->top + (new_size - old_size) <= arena->size)
+    {
+        arena->top += new_size - old_size;
+        return(memory);
+    }
+
+    uint8 *result = sp_internal_arena_take(arena, new_size);
+    if(result)
+    {
+        memcpy(result, memory, (size_t)old_size);
+        sp_internal_arena_release(arena, memory, old_size);
+    }
+    return(result);
+}
+
+// End Registry Memory ----------------------------------------------------
+
+//Adds chunks until the registry can hold new_capacity plugins.
+//Only the array of chunk pointers is reallocated, the chunks themselves (and the plugins in them) never move.
+internal void
+sp_internal_registry_grow(APIRegistry *reg, uint32 new_capacity)
+{
+    uint32 new_chunk_count = (new_capacity + SP_REGISTRY_CHUNK_SIZE - 1) / SP_REGISTRY_CHUNK_SIZE;
+    if(new_chunk_count <= reg->chunk_count)
+    {
+        return;
+    }
+
+    void* alloc_memory = sp_internal_registry_reallocate(reg, reg->plugin_chunks, sizeof(SPlugin*) * new_chunk_count);
+    if(!alloc_memory)
+    {
+        SP_Assert(!"Could not reallocate block");
+    }
+    reg->plugin_chunks = (SPlugin **)alloc_memory;
+
+    //Unlike the chunks the hot arrays can move, nothing outside the registry points into them.
+    uint32 old_capacity = reg->chunk_count * SP_REGISTRY_CHUNK_SIZE;
+    uint32 new_slot_count = new_chunk_count * SP_REGISTRY_CHUNK_SIZE;
+    reg->plugin_api_hashes = (uint64*)sp_internal_registry_reallocate(reg, reg->plugin_api_hashes, sizeof(uint64) * new_slot_count);
+    reg->plugin_apis       = (void**)sp_internal_registry_reallocate(reg, reg->plugin_apis, sizeof(void*) * new_slot_count);
+    memset(reg->plugin_api_hashes + old_capacity, 0, sizeof(uint64) * (new_slot_count - old_capacity));
+    memset(reg->plugin_apis + old_capacity, 0, sizeof(void*) * (new_slot_count - old_capacity));
+
+    uint32 old_word_count = (old_capacity + 31) / 32;
+    uint32 new_word_count = (new_slot_count + 31) / 32;
+    reg->free_slots = (uint32*)sp_internal_registry_reallocate(reg, reg->free_slots, sizeof(uint32) * new_word_count);
+    memset(reg->free_slots + old_word_count, 0, sizeof(uint32) * (new_word_count - old_word_count));
+    for(uint32 index = old_capacity; index < new_slot_count; ++index)
+    {
+        reg->free_slots[index / 32] |= (1u << (index % 32));
+    }
+    if(old_capacity / 32 < reg->free_hint)
+    {
+        reg->free_hint = old_capacity / 32;
+    }
+
+    for(uint32 chunk_index = reg->chunk_count; chunk_index < new_chunk_count; ++chunk_index)
+    {
+        SPlugin *chunk = (SPlugin*)sp_internal_registry_allocate(reg, sizeof(SPlugin) * SP_REGISTRY_CHUNK_SIZE);
+        memset(chunk, 0, sizeof(SPlugin) * SP_REGISTRY_CHUNK_SIZE); //set all plugin values to zero.
+        for(uint32 index = 0; index < SP_REGISTRY_CHUNK_SIZE; ++index)
+        {
+            chunk[index].index      = chunk_index * SP_REGISTRY_CHUNK_SIZE + index;
+            //Handles to slots that were compacted away must not match the plugins that get these slots.
+            chunk[index].generation = reg->released_generation + 1;
+        }
+        reg->plugin_chunks[chunk_index] = chunk;
+    }
+    reg->chunk_count = new_chunk_count;
+    reg->capacity    = new_chunk_count * SP_REGISTRY_CHUNK_SIZE;
+}
+
+#define SP_RETIRE_MEMORY      0
+#define SP_RETIRE_MODULE      1
+#define SP_RETIRE_MODULE_COPY 2 //a module loaded from a temp copy, the copy is deleted once the module is freed
+#define SP_RETIRE_TRAMPOLINES 3 //trampolines of an unloaded api, they are reused once nobody can be calling trough them
+
+//Forward declare, see [Readers].
+internal void sp_internal_registry_retire(APIRegistry *reg, uint32 type, void* ptr);
+
+//Plugins never move, so the registry can not be compacted by moving them. Since the lowest free slot is always
+//taken the plugins gather at the start though, once less than SP_REGISTRY_COMPACT_PERCENT of the capacity is used
+//the empty chunks at the end are given back.
+internal void
+sp_internal_registry_compact(APIRegistry *reg)
+{
+    if((uint32)reg->used * 100 >= (uint32)reg->capacity * SP_REGISTRY_COMPACT_PERCENT)
+    {
+        return;
+    }
+
+    uint32 chunk_count = reg->chunk_count;
+    while(chunk_count > reg->min_chunk_count)
+    {
+        uint32 first = (chunk_count - 1) * SP_REGISTRY_CHUNK_SIZE;
+        bool32 empty = true;
+        for(uint32 index = first; empty && index < first + SP_REGISTRY_CHUNK_SIZE; ++index)
+        {
+            empty = sp_internal_slot_is_free(reg, index);
+        }
+        if(!empty)
+        {
+            break;
+        }
+
+        SPlugin *chunk = reg->plugin_chunks[chunk_count - 1];
+        for(uint32 index = 0; index < SP_REGISTRY_CHUNK_SIZE; ++index)
+        {
+            if(chunk[index].generation > reg->released_generation)
+            {
+                reg->released_generation = chunk[index].generation;
+            }
+        }
+        //Read views point into the chunk (the lookup counters of SP_ENABLE_STATS), readers might still be using one.
+        sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, chunk);
+        reg->plugin_chunks[--chunk_count] = nullptr;
+    }
+    if(chunk_count == reg->chunk_count)
+    {
+        return;
+    }
+
+    SP_TRACE_SCOPE("registry_compact", reg->chunk_count - chunk_count);
+    uint32 slot_count = chunk_count * SP_REGISTRY_CHUNK_SIZE;
+    uint32 word_count = (slot_count + 31) / 32;
+    reg->plugin_api_hashes = (uint64*)sp_internal_registry_reallocate(reg, reg->plugin_api_hashes, sizeof(uint64) * slot_count);
+    reg->plugin_apis       = (void**)sp_internal_registry_reallocate(reg, reg->plugin_apis, sizeof(void*) * slot_count);
+    reg->free_slots        = (uint32*)sp_internal_registry_reallocate(reg, reg->free_slots, sizeof(uint32) * word_count);
+    if(slot_count % 32)
+    {
+        reg->free_slots[word_count - 1] &= (1u << (slot_count % 32)) - 1; //bits past the end are never free
+    }
+    if(reg->free_hint > word_count)
+    {
+        reg->free_hint = word_count;
+    }
+    reg->chunk_count = chunk_count;
+    reg->capacity    = slot_count;
+}
+
+//Hash Functions ----------------------------------------------------
+//@TODO: Try out MurmurHash3
+
+#define SP_HASH(string) sp_internal_djb2_hash(string)
+
+// djb2 Taken from  "http://www.cse.yorku.ca/~oz/hash.html"
+//@NOTE: Kept at 32 bits so it matches sp_internal_djb2_hash_const on every platform.
+uint32 sp_internal_djb2_hash(char* str)
+{
+    uint32 hash = 5381;
+    int c;
+    while (c = *str++){
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    }    
+    return (hash);
+}
+//End Hash Functions ----------------------------------------------------
+
+//API Index ----------------------------------------------------
+//Open addressing (linear probing) table that maps an api_hash to the slot index of the plugin.
+
+#define SP_INDEX_EMPTY     -1
+#define SP_INDEX_TOMBSTONE -2
+
+struct SPIndexEntry
+{
+    uint64 api_hash;
+    int32  slot;
+};
+
+inline uint32
+sp_internal_index_bucket(uint64 api_hash, uint32 index_capacity)
+{
+    //Fibonacci hashing, djb2 does not spread the low bits well enough on its own.
+    uint64 mixed = api_hash * 11400714819323198485ull;
+    return((uint32)(mixed >> 32) & (index_capacity - 1));
+}
+
+internal void
+sp_internal_index_init(APIRegistry *reg, uint32 capacity)
+{
+    uint32 index_capacity = 8;
+    while(index_capacity * SP_REGISTRY_INDEX_MAX_LOAD < capacity * 100)
+    {
+        index_capacity *= 2;
+    }
+    reg->index          = (SPIndexEntry*)sp_internal_registry_allocate(reg, sizeof(SPIndexEntry) * index_capacity);
+    reg->index_capacity = index_capacity;
+    reg->index_used     = 0;
+    reg->index_live     = 0;
+    for(uint32 index = 0; index < index_capacity; ++index)
+    {
+        reg->index[index].api_hash = 0;
+        reg->index[index].slot     = SP_INDEX_EMPTY;
+    }
+}
+
+//Returns the slot of the plugin that provides api_hash or SP_INDEX_EMPTY if there is none.
+inline int32
+sp_internal_index_find(APIRegistry *reg, uint64 api_hash)
+{
+    uint32 mask   = reg->index_capacity - 1;
+    uint32 bucket = sp_internal_index_bucket(api_hash, reg->index_capacity);
+    for(;;)
+    {
+        SPIndexEntry *entry = &reg->index[bucket];
+        if(entry->slot == SP_INDEX_EMPTY)
+        {
+            return(SP_INDEX_EMPTY);
+        }
+        if(entry->slot != SP_INDEX_TOMBSTONE && entry->api_hash == api_hash)
+        {
+            return(entry->slot);
+        }
+        bucket = (bucket + 1) & mask;
+    }
+}
+
+internal void sp_internal_index_rebuild(APIRegistry *reg, uint32 new_index_capacity);
+
+//Maps api_hash to slot. If the api_hash is already in the index (ex: while hot reloading, when both versions
+//are alive) the entry is pointed at the new slot.
+internal void
+sp_internal_index_insert(APIRegistry *reg, uint64 api_hash, int32 slot)
+{
+    uint32 mask   = reg->index_capacity - 1;
+    uint32 bucket = sp_internal_index_bucket(api_hash, reg->index_capacity);
+    SPIndexEntry *free_entry = nullptr;
+    for(;;)
+    {
+        SPIndexEntry *entry = &reg->index[bucket];
+        if(entry->slot == SP_INDEX_EMPTY)
+        {
+            break;
+        }
+        if(entry->slot == SP_INDEX_TOMBSTONE)
+        {
+            if(!free_entry)
+            {
+                free_entry = entry;
+            }
+        }
+        else if(entry->api_hash == api_hash)
+        {
+            entry->slot = slot;
+            return;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+
+    if(free_entry)
+    {
+        //Reusing a tombstone does not change the load.
+        free_entry->api_hash = api_hash;
+        free_entry->slot     = slot;
+        reg->index_live++;
+        return;
+    }
+
+    if((reg->index_used + 1) * 100 > reg->index_capacity * SP_REGISTRY_INDEX_MAX_LOAD)
+    {
+        //While the live entries fill less than half of the max load, dropping the tombstones is enough. Doubling
+        //here would grow the index on every rebuild of a registry that loads and unloads without holding more APIs.
+        uint32 new_index_capacity = reg->index_capacity;
+        if((reg->index_live + 1) * 200 > reg->index_capacity * SP_REGISTRY_INDEX_MAX_LOAD)
+        {
+            new_index_capacity *= 2;
+        }
+        sp_internal_index_rebuild(reg, new_index_capacity);
+        sp_internal_index_insert(reg, api_hash, slot);
+        return;
+    }
+    reg->index[bucket].api_hash = api_hash;
+    reg->index[bucket].slot     = slot;
+    reg->index_used++;
+    reg->index_live++;
+}
+
+//Removes api_hash from the index, but only if it still points at slot.
+internal void
+sp_internal_index_remove(APIRegistry *reg, uint64 api_hash, int32 slot)
+{
+    uint32 mask   = reg->index_capacity - 1;
+    uint32 bucket = sp_internal_index_bucket(api_hash, reg->index_capacity);
+    for(;;)
+    {
+        SPIndexEntry *entry = &reg->index[bucket];
+        if(entry->slot == SP_INDEX_EMPTY)
+        {
+            return;
+        }
+        if(entry->slot != SP_INDEX_TOMBSTONE && entry->api_hash == api_hash)
+        {
+            if(entry->slot == slot)
+            {
+                entry->slot = SP_INDEX_TOMBSTONE;
+                reg->index_live--;
+            }
+            return;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+}
+
+//End API Index ----------------------------------------------------
+
+
+
+
+
+
+//Typedefs of the plugin load and unload function signatures
+typedef void (*load_func)(APIRegistry *, bool32);
+typedef void (*unload_func)(APIRegistry *, bool32);
+
+
+void * sp_internal_api_registry_add(sp_api_key api_key, void* api, uint32 api_size, bool32 reload, APIRegistry *registry);
+void sp_internal_api_registry_remove(sp_api_key api_key, bool32 reload, APIRegistry *registry);
+void * sp_internal_api_registry_get(uint64 api_hash, APIRegistry *registry);
+SPlugin* sp_internal_api_registry_add_new_plugin(APIRegistry *registry);
+void * sp_internal_api_registry_state(sp_api_key api_key, uint32 size, uint32 version, sp_state_migrate_func migrate, APIRegistry *registry);
+
+
+
+//Throws away the tombstones and re-inserts every live plugin, also used to grow the index.
+internal void
+sp_internal_index_rebuild(APIRegistry *reg, uint32 new_index_capacity)
+{
+    SPIndexEntry *old_index = reg->index;
+    uint32 old_index_capacity = reg->index_capacity;
+
+    reg->index          = (SPIndexEntry*)sp_internal_registry_allocate(reg, sizeof(SPIndexEntry) * new_index_capacity);
+    reg->index_capacity = new_index_capacity;
+    reg->index_used     = 0;
+    reg->index_live     = 0;
+    for(uint32 index = 0; index < new_index_capacity; ++index)
+    {
+        reg->index[index].api_hash = 0;
+        reg->index[index].slot     = SP_INDEX_EMPTY;
+    }
+
+    for(uint32 index = 0; index < old_index_capacity; ++index)
+    {
+        SPIndexEntry *entry = &old_index[index];
+        if(entry->slot >= 0)
+        {
+            sp_internal_index_insert(reg, entry->api_hash, entry->slot);
+        }
+    }
+    sp_internal_registry_free(reg, old_index);
+}
+
+internal APIRegistry* sp_internal_registry_get();
+
+// Readers ----------------------------------------------------
+//sp_get_api looks APIs up in a read view, a copy of the index that maps api_hash straight to the api table.
+//A view is never modified once it is published, the thread that owns the registry builds a new one after adding or
+//removing APIs and swaps the pointer (hot reloads keep the api table, so they do not need a new view).
+//
+//Anything other threads might still be using (old views, old modules, api tables of unloaded plugins) is retired
+//instead of freed. Retiring bumps the registry epoch and tags the memory with it, readers copy the registry epoch
+//when they pass a quiescent point, once every reader is at or past the tag nobody can be using it and it is freed
+//(quiescent state based reclamation). With no readers registered retired memory is freed right away.
+
+//The SP_RETIRE_* types are defined with sp_internal_registry_compact, which is the first to retire anything.
+
+struct SPViewEntry
+{
+    uint64 api_hash;
+    void* api; //nullptr means empty
+    #ifdef SP_ENABLE_STATS
+    uint64 *lookups; //in the stats of the plugin, plugins never move so this stays valid
+    #endif //SP_ENABLE_STATS
+};
+
+struct SPReadView
+{
+    uint32 capacity; //always a power of two
+    SPViewEntry entries[1];
+};
+
+struct SPReader
+{
+    volatile LONG64 epoch;
+    SPReaders *readers;
+    SPReader *next;
+};
+
+struct SPRetired
+{
+    int64 epoch;
+    uint32 type;
+    void* ptr;
+};
+
+struct SPReaders
+{
+    SRWLOCK lock; //taken when readers register and when the owner retires or reclaims, never by lookups
+    volatile LONG64 epoch;
+    SPReader *first;
+    uint32 count;
+
+    SPRetired *retired;
+    uint32 retired_count;
+    uint32 retired_capacity;
+};
+
+internal void sp_internal_win32_retire_module(HMODULE module, bool32 copy);
+internal void sp_internal_win32_free_module_copy(HMODULE module);
+
+//Forward declare, see [Trampolines].
+internal void sp_internal_trampolines_reclaim(APIRegistry *reg, SPTrampolineRun *run);
+
+internal void
+sp_internal_free_retired(APIRegistry *reg, uint32 type, void* ptr)
+{
+    if(type == SP_RETIRE_MODULE || type == SP_RETIRE_MODULE_COPY)
+    {
+        #ifdef SP_ASYNC_RELOAD
+        sp_internal_win32_retire_module((HMODULE)ptr, type == SP_RETIRE_MODULE_COPY);
+        #else
+        if(type == SP_RETIRE_MODULE_COPY)
+        {
+            sp_internal_win32_free_module_copy((HMODULE)ptr);
+        }
+        else
+        {
+            FreeLibrary((HMODULE)ptr);
+        }
+        #endif //SP_ASYNC_RELOAD
+    }
+    else if(type == SP_RETIRE_TRAMPOLINES)
+    {
+        sp_internal_trampolines_reclaim(reg, (SPTrampolineRun*)ptr);
+    }
+    else
+    {
+        sp_internal_registry_free(reg, ptr);
+    }
+}
+
+internal SPReadView *
+sp_internal_view_create(APIRegistry *reg, uint32 capacity)
+{
+    SPReadView *view = (SPReadView*)sp_internal_registry_allocate(reg, sizeof(SPReadView) + sizeof(SPViewEntry) * (capacity - 1));
+    memset(view->entries, 0, sizeof(SPViewEntry) * capacity);
+    view->capacity = capacity;
+    return(view);
+}
+
+inline SPViewEntry *
+sp_internal_view_find_entry(SPReadView *view, uint64 api_hash)
+{
+    uint32 mask   = view->capacity - 1;
+    uint32 bucket = sp_internal_index_bucket(api_hash, view->capacity);
+    for(;;)
+    {
+        SPViewEntry *entry = &view->entries[bucket];
+        if(!entry->api)
+        {
+            return(0);
+        }
+        if(entry->api_hash == api_hash)
+        {
+            return(entry);
+        }
+        bucket = (bucket + 1) & mask;
+    }
+}
+
+inline void *
+sp_internal_view_find(SPReadView *view, uint64 api_hash)
+{
+    SPViewEntry *entry = sp_internal_view_find_entry(view, api_hash);
+    return(entry ? entry->api : 0);
+}
+
+internal void
+sp_internal_readers_init(APIRegistry *reg)
+{
+    reg->readers = (SPReaders*)sp_internal_registry_allocate(reg, sizeof(SPReaders));
+    *reg->readers = {};
+    InitializeSRWLock(&reg->readers->lock);
+    reg->readers->epoch = 1;
+    reg->read_view = sp_internal_view_create(reg, 8);
+}
+
+//Hands memory or a module that readers might still be using over to the reclamation.
+internal void
+sp_internal_registry_retire(APIRegistry *reg, uint32 type, void* ptr)
+{
+    if(!ptr)
+    {
+        return;
+    }
+    SPReaders *readers = reg->readers;
+    AcquireSRWLockExclusive(&readers->lock);
+    if(!readers->count)
+    {
+        ReleaseSRWLockExclusive(&readers->lock);
+        sp_internal_free_retired(reg, type, ptr);
+        return;
+    }
+
+    if(readers->retired_count == readers->retired_capacity)
+    {
+        readers->retired_capacity = readers->retired_capacity ? readers->retired_capacity * 2 : 16;
+        readers->retired = (SPRetired*)sp_internal_registry_reallocate(reg, readers->retired, sizeof(SPRetired) * readers->retired_capacity);
+    }
+    SPRetired *retired = &readers->retired[readers->retired_count++];
+    retired->epoch = InterlockedIncrement64(&readers->epoch);
+    retired->type  = type;
+    retired->ptr   = ptr;
+    ReleaseSRWLockExclusive(&readers->lock);
+}
+
+//Frees everything that every reader has moved past.
+internal void
+sp_internal_registry_reclaim(APIRegistry *reg)
+{
+    SPReaders *readers = reg->readers;
+    if(!readers->retired_count)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&readers->lock);
+    int64 min_epoch = INT64_MAX;
+    for(SPReader *reader = readers->first; reader; reader = reader->next)
+    {
+        int64 epoch = reader->epoch;
+        if(epoch < min_epoch)
+        {
+            min_epoch = epoch;
+        }
+    }
+
+    uint32 kept = 0;
+    for(uint32 index = 0; index < readers->retired_count; ++index)
+    {
+        SPRetired retired = readers->retired[index];
+        if(retired.epoch <= min_epoch)
+        {
+            sp_internal_free_retired(reg, retired.type, retired.ptr);
+        }
+        else
+        {
+            readers->retired[kept++] = retired;
+        }
+    }
+    readers->retired_count = kept;
+    ReleaseSRWLockExclusive(&readers->lock);
+}
+
+// Thread Cache ----------------------------------------------------
+//Direct mapped cache (api_hash -> api) per thread in front of the read views. Entries are tagged with their registry,
+//all of them are dropped when sp_global_epoch moves. The epoch is bumped every time a registry publishes a change
+//or is destroyed, it sits on its own cache line so checking it does not share a line with what sp_update writes.
+
+struct alignas(64) SPGlobalEpoch
+{
+    volatile int64 value;
+};
+
+global_variable SPGlobalEpoch sp_global_epoch;
+
+#ifdef SP_ENABLE_THREAD_CACHE
+struct SPThreadCacheEntry
+{
+    APIRegistry *registry;
+    SPViewEntry entry;
+};
+
+struct SPThreadCache
+{
+    int64 epoch;
+    SPThreadCacheEntry entries[SP_THREAD_CACHE_SIZE];
+};
+
+thread_local SPThreadCache sp_thread_cache;
+
+//Returns the slot of the cache for api_hash, the cache is emptied first if the epoch moved.
+//epoch must be read before the registry is looked at, so an entry filled in from an old view is dropped on the next lookup.
+inline SPThreadCacheEntry *
+sp_internal_thread_cache_slot(uint64 api_hash, int64 epoch)
+{
+    SPThreadCache *cache = &sp_thread_cache;
+    if(cache->epoch != epoch)
+    {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->epoch = epoch;
+    }
+    return(&cache->entries[sp_internal_index_bucket(api_hash, SP_THREAD_CACHE_SIZE)]);
+}
+#endif //SP_ENABLE_THREAD_CACHE
+
+// End Thread Cache ----------------------------------------------------
+
+//Builds a new read view from the index and swaps it in.
+internal void
+sp_internal_registry_publish_view(APIRegistry *reg)
+{
+    SP_TRACE_SCOPE("publish_read_view", 0);
+
+    SPReadView *view = sp_internal_view_create(reg, reg->index_capacity);
+    uint32 mask = view->capacity - 1;
+    for(uint32 index = 0; index < reg->index_capacity; ++index)
+    {
+        SPIndexEntry *entry = &reg->index[index];
+        if(entry->slot < 0)
+        {
+            continue;
+        }
+        void *api = reg->plugin_apis[entry->slot];
+        if(!api)
+        {
+            continue;
+        }
+        uint32 bucket = sp_internal_index_bucket(entry->api_hash, view->capacity);
+        while(view->entries[bucket].api)
+        {
+            bucket = (bucket + 1) & mask;
+        }
+        view->entries[bucket].api_hash = entry->api_hash;
+        view->entries[bucket].api      = api;
+        #ifdef SP_ENABLE_STATS
+        view->entries[bucket].lookups  = &sp_internal_registry_slot(reg, entry->slot)->stats.lookups;
+        #endif //SP_ENABLE_STATS
+    }
+
+    SPReadView *old_view = reg->read_view;
+    InterlockedExchangePointer((PVOID volatile *)&reg->read_view, view);
+    sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, old_view);
+}
+
+//Makes the APIs that were added, removed or reloaded since the last publish visible to sp_get_api.
+//The generation is bumped after the new view is in place, so a reader that sees the new generation also sees the change.
+internal void
+sp_internal_registry_publish(APIRegistry *reg)
+{
+    if(reg->view_dirty)
+    {
+        reg->view_dirty = false;
+        reg->generation_dirty = true;
+        sp_internal_registry_publish_view(reg);
+    }
+    if(reg->generation_dirty)
+    {
+        reg->generation_dirty = false;
+        InterlockedIncrement64(&reg->generation);
+        InterlockedIncrement64(&sp_global_epoch.value);
+    }
+}
+
+SPReader * sp_reader_register(APIRegistry *registry)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    SPReaders *readers = reg->readers;
+
+    //Readers register from their own threads, so they do not come from the registry allocator.
+    SPReader *reader = (SPReader*)malloc(sizeof(SPReader));
+    *reader = {};
+    reader->readers = readers;
+
+    AcquireSRWLockExclusive(&readers->lock);
+    reader->epoch = readers->epoch;
+    reader->next  = readers->first;
+    readers->first = reader;
+    readers->count++;
+    ReleaseSRWLockExclusive(&readers->lock);
+    return(reader);
+}
+
+SPReader * sp_reader_register()
+{
+    return(sp_reader_register(nullptr));
+}
+
+void sp_reader_quiescent(SPReader *reader)
+{
+    InterlockedExchange64(&reader->epoch, reader->readers->epoch);
+}
+
+void sp_reader_unregister(SPReader *reader)
+{
+    SPReaders *readers = reader->readers;
+    AcquireSRWLockExclusive(&readers->lock);
+    for(SPReader **at = &readers->first; *at; at = &(*at)->next)
+    {
+        if(*at == reader)
+        {
+            *at = reader->next;
+            readers->count--;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&readers->lock);
+    free(reader);
+}
+
+// End Readers ----------------------------------------------------
+
+global_variable APIRegistry sp_registry = {};
+
+APIRegistry sp_registry_create(uint32 capacity, SPAllocator allocator)
+{
+    APIRegistry reg = {};
+    reg.allocator       = allocator;
+    reg.used            = 0;
+    reg.owner_thread_id = GetCurrentThreadId();
+    sp_internal_registry_grow(&reg, capacity);
+    reg.min_chunk_count = reg.chunk_count;
+    sp_internal_index_init(&reg, reg.capacity);
+    sp_internal_readers_init(&reg);
+    reg.add             = sp_internal_api_registry_add;
+    reg.remove          = sp_internal_api_registry_remove;
+    reg.get             = sp_internal_api_registry_get;
+    reg.state           = sp_internal_api_registry_state;
+    return(reg);
+}
+
+APIRegistry sp_registry_create(uint32 capacity)
+{
+    return(sp_registry_create(capacity, sp_default_allocator));
+}
+
+APIRegistry sp_registry_create(uint32 capacity, void *memory, uint64 memory_size)
+{
+    uint8 *start = (uint8*)SP_MEMORY_ALIGN((uintptr_t)memory);
+    uint8 *end   = (uint8*)memory + memory_size;
+    SP_Assert(start + SP_MEMORY_ALIGN(sizeof(SPArena)) < end);
+
+    SPArena *arena = (SPArena*)start;
+    *arena = {};
+    arena->memory = start + SP_MEMORY_ALIGN(sizeof(SPArena));
+    arena->size   = (uint64)(end - arena->memory) & ~(uint64)15;
+
+    SPAllocator allocator = {arena, sp_internal_arena_reallocate};
+    return(sp_registry_create(capacity, allocator));
+}
+
+void sp_set_default_allocator(SPAllocator allocator)
+{
+    //The default registry keeps the allocator it was created with.
+    SP_Assert(!sp_registry.plugin_chunks);
+    sp_default_allocator = allocator;
+}
+
+uint64 sp_registry_memory_used(APIRegistry *registry, uint64 *peak)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    if(peak)
+    {
+        *peak = reg->memory_peak;
+    }
+    return(reg->memory_used);
+}
+
+internal APIRegistry* 
+sp_internal_registry_get()
+{
+    //Created on first use instead of during static initialization, so sp_set_default_allocator can be called first.
+    if(!sp_registry.plugin_chunks)
+    {
+        sp_registry = sp_registry_create(SP_REGISTRY_INITIAL_CAPACITY, sp_default_allocator);
+    }
+    return (&sp_registry);
+}
+
+//Other threads might be calling trough the table while we fill it in, so the function pointers are written one
+//at a time, that way a reader gets either the old or the new pointer and never half of each.
+internal void
+sp_internal_copy_api_table(void* dest, void* source, uint32 size)
+{
+    if(size % sizeof(void*) == 0 && ((uintptr_t)dest % sizeof(void*)) == 0)
+    {
+        void* volatile *dest_ptr = (void* volatile *)dest;
+        void **source_ptr = (void **)source;
+        for(uint32 index = 0; index < size / sizeof(void*); ++index)
+        {
+            dest_ptr[index] = source_ptr[index];
+        }
+    }
+    else
+    {
+        memcpy(dest, source, size);
+    }
+}
+
+// Trampolines (SP_API_TRAMPOLINES) ----------------------------------------------------
+//A trampoline block is one allocation split in two halves. The first half is code, one stub per trampoline that is only
+//an indirect jump trough the matching pointer in the second half (the targets).
+//The code is written once when the block is created and is then made execute/read only, retargeting a trampoline
+//is just writing a pointer. The api table of the plugin holds the addresses of the stubs, the targets hold the
+//addresses of the functions in the currently loaded module.
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define SP_TRAMPOLINES_SUPPORTED
+#endif
+
+#define SP_TRAMPOLINE_BLOCK_SIZE KiloBytes(64)
+#define SP_TRAMPOLINE_STUB_SIZE  8
+#define SP_TRAMPOLINES_PER_BLOCK ((SP_TRAMPOLINE_BLOCK_SIZE / 2) / SP_TRAMPOLINE_STUB_SIZE)
+
+struct SPTrampolineBlock
+{
+    uint8 *code;
+    void **targets;
+    uint32 used;
+    SPTrampolineBlock *next;
+};
+
+//Trampolines of an api that was unloaded. They are retired (SP_RETIRE_TRAMPOLINES) and only go on the free list
+//once no reader can be calling trough them anymore, until they are reused they jump to sp_internal_trampoline_dead.
+struct SPTrampolineRun
+{
+    void **targets;
+    uint32 count;
+    SPTrampolineRun *next;
+};
+
+//Where dead trampolines jump to, a function pointer to an unloaded plugin was called.
+internal void
+sp_internal_trampoline_dead()
+{
+    SP_Assert(!"Called a function of a plugin that was unloaded");
+}
+
+//The stub that jumps trough target.
+internal uint8 *
+sp_internal_trampoline_stub(APIRegistry *reg, void **target)
+{
+    for(SPTrampolineBlock *block = reg->trampolines; block; block = block->next)
+    {
+        if(target >= block->targets && target < block->targets + SP_TRAMPOLINES_PER_BLOCK)
+        {
+            return(block->code + (target - block->targets) * SP_TRAMPOLINE_STUB_SIZE);
+        }
+    }
+    InvalidCodePath;
+    return(nullptr);
+}
+
+#ifdef SP_TRAMPOLINES_SUPPORTED
+internal SPTrampolineBlock *
+sp_internal_win32_trampoline_block_create(APIRegistry *reg)
+{
+    uint8 *memory = (uint8*)VirtualAlloc(0, SP_TRAMPOLINE_BLOCK_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(!memory)
+    {
+        return(nullptr);
+    }
+    SPTrampolineBlock *block = (SPTrampolineBlock*)sp_internal_registry_allocate(reg, sizeof(SPTrampolineBlock));
+    *block = {};
+    block->code    = memory;
+    block->targets = (void**)(memory + SP_TRAMPOLINE_BLOCK_SIZE / 2);
+
+    for(uint32 index = 0; index < SP_TRAMPOLINES_PER_BLOCK; ++index)
+    {
+        uint8 *stub = block->code + index * SP_TRAMPOLINE_STUB_SIZE;
+        #if defined(_M_X64)
+        //jmp qword ptr [rip + offset]
+        int32 operand = (int32)((uint8*)&block->targets[index] - (stub + 6));
+        #else
+        //jmp dword ptr [address]
+        int32 operand = (int32)(uintptr_t)&block->targets[index];
+        #endif
+        stub[0] = 0xFF;
+        stub[1] = 0x25;
+        memcpy(stub + 2, &operand, sizeof(operand));
+        stub[6] = 0xCC; //int3 padding
+        stub[7] = 0xCC;
+    }
+
+    DWORD old_protect = 0;
+    VirtualProtect(block->code, SP_TRAMPOLINE_BLOCK_SIZE / 2, PAGE_EXECUTE_READ, &old_protect);
+    FlushInstructionCache(GetCurrentProcess(), block->code, SP_TRAMPOLINE_BLOCK_SIZE / 2);
+    return(block);
+}
+#endif //SP_TRAMPOLINES_SUPPORTED
+
+//Points every function pointer in table at a new trampoline and every trampoline at the matching function in api.
+//Returns the targets of the trampolines, or nullptr if the api can not use trampolines (the caller then copies the api as is).
+internal void **
+sp_internal_trampolines_create(APIRegistry *reg, void* table, void* api, uint32 api_size)
+{
+    #ifdef SP_TRAMPOLINES_SUPPORTED
+    uint32 count = api_size / sizeof(void*);
+    if(api_size % sizeof(void*) != 0 || count > SP_TRAMPOLINES_PER_BLOCK)
+    {
+        return(nullptr);
+    }
+
+    //Reuse the trampolines of an unloaded api if there are enough of them in one run.
+    void **targets = nullptr;
+    uint8 *code = nullptr;
+    for(SPTrampolineRun **at = &reg->free_trampolines; *at; at = &(*at)->next)
+    {
+        SPTrampolineRun *run = *at;
+        if(run->count >= count)
+        {
+            targets = run->targets;
+            code = sp_internal_trampoline_stub(reg, targets);
+            run->targets += count;
+            run->count   -= count;
+            if(!run->count)
+            {
+                *at = run->next;
+                sp_internal_registry_free(reg, run);
+            }
+            break;
+        }
+    }
+
+    if(!targets)
+    {
+        SPTrampolineBlock *block = reg->trampolines;
+        if(!block || (block->used + count) > SP_TRAMPOLINES_PER_BLOCK)
+        {
+            block = sp_internal_win32_trampoline_block_create(reg);
+            if(!block)
+            {
+                return(nullptr);
+            }
+            block->next = reg->trampolines;
+            reg->trampolines = block;
+        }
+        targets = &block->targets[block->used];
+        code = block->code + block->used * SP_TRAMPOLINE_STUB_SIZE;
+        block->used += count;
+    }
+
+    void **functions = (void**)api;
+    void **table_functions = (void**)table;
+    for(uint32 index = 0; index < count; ++index)
+    {
+        targets[index] = functions[index];
+        table_functions[index] = code + index * SP_TRAMPOLINE_STUB_SIZE;
+    }
+    return(targets);
+    #else
+    return(nullptr);
+    #endif //SP_TRAMPOLINES_SUPPORTED
+}
+
+//Called when the api that owns the trampolines is unloaded (or got new ones), they keep jumping into the old module
+//until readers are done with it.
+internal void
+sp_internal_trampolines_release(APIRegistry *reg, void **targets, uint32 api_size)
+{
+    SPTrampolineRun *run = (SPTrampolineRun*)sp_internal_registry_allocate(reg, sizeof(SPTrampolineRun));
+    run->targets = targets;
+    run->count   = api_size / sizeof(void*);
+    run->next    = nullptr;
+    sp_internal_registry_retire(reg, SP_RETIRE_TRAMPOLINES, run);
+}
+
+internal void
+sp_internal_trampolines_reclaim(APIRegistry *reg, SPTrampolineRun *run)
+{
+    for(uint32 index = 0; index < run->count; ++index)
+    {
+        run->targets[index] = (void*)sp_internal_trampoline_dead;
+    }
+    run->next = reg->free_trampolines;
+    reg->free_trampolines = run;
+}
+
+internal void
+sp_internal_trampolines_destroy(APIRegistry *reg)
+{
+    SPTrampolineRun *run = reg->free_trampolines;
+    while(run)
+    {
+        SPTrampolineRun *next = run->next;
+        sp_internal_registry_free(reg, run);
+        run = next;
+    }
+    reg->free_trampolines = nullptr;
+
+    SPTrampolineBlock *block = reg->trampolines;
+    while(block)
+    {
+        SPTrampolineBlock *next = block->next;
+        VirtualFree(block->code, 0, MEM_RELEASE);
+        sp_internal_registry_free(reg, block);
+        block = next;
+    }
+    reg->trampolines = nullptr;
+}
+
+// End Trampolines ----------------------------------------------------
+
+//The api struct that the plugin passes in is copied into a table allocated by the registry (host memory).
+//When reloading, the previous version is still registered so we fill its table in place, this way the
+//address the callers got from sp_get_api never changes across reloads.
+//If the new version changed the size of the api struct it gets a new table, the old one is retired once the reload
+//has been published (sp_internal_win32_publish_module).
+//With SP_API_TRAMPOLINES the table holds trampolines and on reload only their targets are filled in.
+//Returns the registry owned table.
+void * sp_internal_api_registry_add(sp_api_key api_key, void* api, uint32 api_size, bool32 reload, APIRegistry *registry)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    SPlugin *plugin = nullptr;
+
+    void *table = nullptr;
+    void **trampoline_targets = nullptr;
+    SPlugin *old_plugin = nullptr;
+    if(reload)
+    {
+        int32 old_slot = sp_internal_index_find(reg, api_key.hash);
+        if(old_slot != SP_INDEX_EMPTY)
+        {
+            old_plugin = sp_internal_registry_slot(reg, old_slot);
+            if(old_plugin->api_size == api_size)
+            {
+                table = reg->plugin_apis[old_slot];
+                trampoline_targets = old_plugin->trampoline_targets;
+            }
+        }
+    }
+    if(!table)
+    {
+        table = sp_internal_registry_allocate(reg, api_size);
+        #ifdef SP_API_TRAMPOLINES
+        trampoline_targets = sp_internal_trampolines_create(reg, table, api, api_size);
+        #endif //SP_API_TRAMPOLINES
+        if(!trampoline_targets)
+        {
+            memcpy(table, api, api_size);
+        }
+        reg->view_dirty = true;
+    }
+    else if(trampoline_targets)
+    {
+        sp_internal_copy_api_table(trampoline_targets, api, api_size);
+    }
+    else
+    {
+        sp_internal_copy_api_table(table, api, api_size);
+    }
+
+    //The slot the loader has been filling in. A second api from the same load function (or an add from outside of one)
+    //gets the lowest free slot.
+    plugin = reg->loading_plugin;
+    reg->loading_plugin = nullptr;
+    if(!plugin)
+    {
+        plugin = sp_internal_api_registry_add_new_plugin(reg);
+    }
+    sp_internal_slot_claim(reg, plugin->index);
+    reg->plugin_api_hashes[plugin->index] = api_key.hash;
+    reg->plugin_apis[plugin->index]       = table;
+    plugin->api_size = api_size;
+    plugin->trampoline_targets = trampoline_targets;
+    plugin->previous_version = (old_plugin != plugin) ? old_plugin : nullptr;
+    plugin->api_generation = (uint64)reg->generation + 1; //the generation the next publish bumps to
+    sp_internal_index_insert(reg, api_key.hash, (int32)plugin->index);
+
+    reg->used++;
+
+    return(table);
+}
+
+//Both versions of a reloaded plugin are registered while the old one runs its unload function. The index already
+//points at the new version (its add re-pointed it), which knows the slot of the old one, so nothing is scanned.
+void sp_internal_api_registry_remove_reloaded(uint64 hash, APIRegistry* registry)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    int32 slot = sp_internal_index_find(reg, hash);
+    if(slot == SP_INDEX_EMPTY)
+    {
+        return;
+    }
+    SPlugin *newest = sp_internal_registry_slot(reg, slot);
+    SPlugin *plugin = newest->previous_version;
+    //@NOTE: No previous version means the new version did not add this api again, the old one stays registered.
+    if(plugin && reg->plugin_api_hashes[plugin->index] == hash)
+    {
+        sp_internal_plugin_reset(reg, plugin); //reset this slot
+    }
+    newest->previous_version = nullptr;
+}
+
+// Plugin State ----------------------------------------------------
+
+//Header of a state block, the state follows it. 16 bytes so the state keeps the alignment of the allocation.
+struct SPStateHeader
+{
+    uint32 size;
+    uint32 version;
+    uint64 pad;
+};
+
+struct SPPluginState
+{
+    uint64 api_hash;
+    SPStateHeader *block;
+    SPStateHeader *previous; //block from before a migration, freed once the old version of the plugin is unloaded
+};
+
+internal int32
+sp_internal_state_find(APIRegistry *reg, uint64 api_hash)
+{
+    for(uint32 index = 0; index < reg->state_count; ++index)
+    {
+        if(reg->states[index].api_hash == api_hash)
+        {
+            return((int32)index);
+        }
+    }
+    return(-1);
+}
+
+internal SPStateHeader *
+sp_internal_state_block_create(APIRegistry *reg, uint32 size, uint32 version)
+{
+    SPStateHeader *block = (SPStateHeader*)sp_internal_registry_allocate(reg, sizeof(SPStateHeader) + size);
+    memset(block, 0, sizeof(SPStateHeader) + size);
+    block->size    = size;
+    block->version = version;
+    return(block);
+}
+
+//Gives the state a new block for the new layout, the old one is kept until the old version of the plugin is unloaded
+//since it is still running while the new version loads.
+internal void
+sp_internal_api_registry_transfer_state(APIRegistry *reg, SPPluginState *state, uint32 size, uint32 version, sp_state_migrate_func migrate)
+{
+    SPStateHeader *old_block = state->block;
+    SPStateHeader *new_block = sp_internal_state_block_create(reg, size, version);
+    if(migrate)
+    {
+        migrate(old_block + 1, old_block->size, old_block->version, new_block + 1, size);
+    }
+    //A plugin that is migrated twice in one load only keeps the first block around.
+    if(state->previous)
+    {
+        sp_internal_registry_free(reg, old_block);
+    }
+    else
+    {
+        state->previous = old_block;
+    }
+    state->block = new_block;
+}
+
+void * sp_internal_api_registry_state(sp_api_key api_key, uint32 size, uint32 version, sp_state_migrate_func migrate, APIRegistry *registry)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    int32 index = sp_internal_state_find(reg, api_key.hash);
+    if(index == -1)
+    {
+        if(reg->state_count == reg->state_capacity)
+        {
+            reg->state_capacity = reg->state_capacity ? reg->state_capacity * 2 : 8;
+            reg->states = (SPPluginState*)sp_internal_registry_reallocate(reg, reg->states, sizeof(SPPluginState) * reg->state_capacity);
+        }
+        index = (int32)reg->state_count++;
+        SPPluginState *state = &reg->states[index];
+        state->api_hash = api_key.hash;
+        state->block    = sp_internal_state_block_create(reg, size, version);
+        state->previous = nullptr;
+    }
+    else
+    {
+        SPPluginState *state = &reg->states[index];
+        if(state->block->size != size || state->block->version != version)
+        {
+            sp_internal_api_registry_transfer_state(reg, state, size, version, migrate);
+        }
+    }
+    return(reg->states[index].block + 1);
+}
+
+//Called once the old version of a reloaded plugin has been unloaded. Other threads could still be running its code.
+internal void
+sp_internal_state_release_previous(APIRegistry *reg, uint64 api_hash)
+{
+    int32 index = sp_internal_state_find(reg, api_hash);
+    if(index != -1)
+    {
+        sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, reg->states[index].previous);
+        reg->states[index].previous = nullptr;
+    }
+}
+
+internal void
+sp_internal_state_free(APIRegistry *reg, uint64 api_hash)
+{
+    int32 index = sp_internal_state_find(reg, api_hash);
+    if(index != -1)
+    {
+        sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, reg->states[index].block);
+        sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, reg->states[index].previous);
+        reg->states[index] = reg->states[--reg->state_count];
+    }
+}
+
+// End Plugin State ----------------------------------------------------
+
+internal void sp_internal_watcher_remove(SPWatcher *watcher, SPlugin *plugin);
+
+//The API must be out of the read view (sp_internal_registry_publish) before this is called.
+void sp_internal_plugin_cleanup(APIRegistry *reg, SPlugin *plugin)
+{
+    if(plugin->reloadable)
+    {
+        //Swap the last reloadable plugin into the hole.
+        SPlugin *last = reg->reloadable_plugins[--reg->reloadable_count];
+        reg->reloadable_plugins[plugin->reloadable_index] = last;
+        last->reloadable_index = plugin->reloadable_index;
+        if(reg->watcher)
+        {
+            sp_internal_watcher_remove(reg->watcher, plugin);
+        }
+    }
+
+    for(uint32 index = 0; index < reg->reloaded_count; ++index)
+    {
+        if(reg->reloaded_plugins[index] == plugin)
+        {
+            //Keep the reload order.
+            memmove(reg->reloaded_plugins + index, reg->reloaded_plugins + index + 1, sizeof(SPlugin*) * (reg->reloaded_count - index - 1));
+            reg->reloaded_count--;
+            break;
+        }
+    }
+
+    //The api table and the state are owned by the registry, a reloaded plugin hands them over to the new version so this is only reached on unload.
+    sp_internal_state_free(reg, reg->plugin_api_hashes[plugin->index]);
+    if(plugin->trampoline_targets)
+    {
+        sp_internal_trampolines_release(reg, plugin->trampoline_targets, plugin->api_size);
+    }
+    sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, reg->plugin_apis[plugin->index]);
+    reg->plugin_apis[plugin->index] = nullptr;
+
+    #ifdef _WIN32
+        CloseHandle(plugin->file_handle);
+        //Only reloadable plugins are loaded from a temp copy.
+        sp_internal_registry_retire(reg, plugin->reloadable ? SP_RETIRE_MODULE_COPY : SP_RETIRE_MODULE, plugin->library_handle);
+    #else
+        //@TODO: Do other OS
+        #error NO OTHER OS DEFINED
+
+    #endif //_WIN32
+}
+
+void sp_internal_api_registry_remove(sp_api_key api_key, bool32 reload, APIRegistry *registry)
+{
+    //@TODO: Make sure to close the file_handle (win32) if this was a reloadable plugin.
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    uint64 desired_api_hash = api_key.hash;
+
+    if(reload)
+    {
+        sp_internal_api_registry_remove_reloaded(desired_api_hash, reg);
+    }
+    else
+    {
+        int32 slot = sp_internal_index_find(reg, desired_api_hash);
+        if(slot != SP_INDEX_EMPTY)
+        {
+            sp_internal_index_remove(reg, desired_api_hash, slot);
+            reg->view_dirty = true;
+        }
+    }
+    reg->used--;
+}
+
+// Lazy Plugins ----------------------------------------------------
+
+struct SPLazyPlugin
+{
+    uint64 api_hash;
+    bool32 reloadable;
+    char plugin_name[256];
+};
+
+//Forward declare.
+SPlugin * sp_internal_win32_load_plugin(char* plugin_name, bool32 reloadable, APIRegistry *registry);
+
+internal int32
+sp_internal_lazy_find(APIRegistry *reg, uint64 api_hash)
+{
+    for(uint32 index = 0; index < reg->lazy_count; ++index)
+    {
+        if(reg->lazy_plugins[index].api_hash == api_hash)
+        {
+            return((int32)index);
+        }
+    }
+    return(-1);
+}
+
+internal void
+sp_internal_lazy_remove(APIRegistry *reg, int32 index)
+{
+    reg->lazy_plugins[index] = reg->lazy_plugins[--reg->lazy_count];
+}
+
+//Loads the lazy plugin that provides api_hash, returns its API or nullptr if there is none.
+internal void *
+sp_internal_api_registry_load_lazy(APIRegistry *reg, uint64 api_hash)
+{
+    #ifdef _WIN32
+    if(GetCurrentThreadId() != reg->owner_thread_id)
+    {
+        return(nullptr);
+    }
+    #else
+        //@TODO: Add other OS
+        #error NO OTHER OS DEFINED
+    #endif //_WIN32
+
+    int32 index = sp_internal_lazy_find(reg, api_hash);
+    if(index == -1)
+    {
+        return(nullptr);
+    }
+    //Removed before loading, if the plugin fails to load we do not try again on every lookup.
+    SPLazyPlugin lazy = reg->lazy_plugins[index];
+    sp_internal_lazy_remove(reg, index);
+
+    SPlugin *plugin = sp_internal_win32_load_plugin(lazy.plugin_name, lazy.reloadable, reg);
+    if(!plugin)
+    {
+        return(nullptr);
+        //@TODO: Log could not load lazy plugin.
+    }
+    sp_internal_registry_publish(reg);
+
+    void *api = sp_internal_view_find(reg->read_view, api_hash);
+    SP_Assert(api); //The plugin did not register the API it was registered for.
+    return(api);
+}
+
+// End Lazy Plugins ----------------------------------------------------
+
+void * sp_internal_api_registry_get(uint64 api_hash, APIRegistry *registry)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    #ifdef SP_ENABLE_THREAD_CACHE
+    int64 epoch = sp_global_epoch.value;
+    SP_READ_BARRIER();
+    SPThreadCacheEntry *cached = sp_internal_thread_cache_slot(api_hash, epoch);
+    if(cached->entry.api_hash == api_hash && cached->registry == reg)
+    {
+        #ifdef SP_ENABLE_STATS
+        InterlockedIncrement64((volatile LONG64 *)cached->entry.lookups);
+        #endif //SP_ENABLE_STATS
+        return(cached->entry.api);
+    }
+    #endif //SP_ENABLE_THREAD_CACHE
+
+    //Lock free, see [Readers].
+    SPReadView *view = reg->read_view;
+    SP_READ_BARRIER();
+    SPViewEntry *entry = sp_internal_view_find_entry(view, api_hash);
+    if(entry)
+    {
+        #ifdef SP_ENABLE_STATS
+        InterlockedIncrement64((volatile LONG64 *)entry->lookups);
+        #endif //SP_ENABLE_STATS
+        #ifdef SP_ENABLE_THREAD_CACHE
+        cached->registry = reg;
+        cached->entry    = *entry;
+        #endif //SP_ENABLE_THREAD_CACHE
+        return(entry->api);
+    }
+
+    void *api = nullptr;
+    if(reg->lazy_count)
+    {
+        //Only a miss gets here, once a lazy plugin is loaded its API is found above.
+        api = sp_internal_api_registry_load_lazy(reg, api_hash);
+    }
+    #ifdef SP_ENABLE_STATS
+    if(!api)
+    {
+        InterlockedIncrement64((volatile LONG64 *)&reg->stats.failed_lookups);
+    }
+    #endif //SP_ENABLE_STATS
+    return(api);
+}
+
+void * sp_get_api(APIRegistry *registry,char *api_name)
+{
+    uint64 api_hash = SP_HASH(api_name);
+    return(sp_internal_api_registry_get(api_hash, registry));
+}
+
+void * sp_get_api(APIRegistry *registry,SPlugin *plugin)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    return(sp_internal_api_registry_get(sp_internal_plugin_api_hash(reg, plugin), reg));
+}
+
+void * sp_get_api(char *api_name)
+{
+    uint64 api_hash = SP_HASH(api_name);
+    return(sp_internal_api_registry_get(api_hash, nullptr));
+}
+
+void * sp_get_api(SPlugin *plugin)
+{
+    return(sp_get_api((APIRegistry*)nullptr, plugin));
+}
+
+void * sp_get_api(APIRegistry *registry,sp_api_key api_key)
+{
+    return(sp_internal_api_registry_get(api_key.hash, registry));
+}
+
+void * sp_get_api(sp_api_key api_key)
+{
+    return(sp_internal_api_registry_get(api_key.hash, nullptr));
+}
+
+//The generation is read before the lookup, if a change is published in between the api is looked up again on the next use.
+void * sp_internal_api_ref_resolve(APIRegistry *registry, sp_api_key api_key, const volatile int64 **generation_word, int64 *generation)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    *generation_word = &reg->generation;
+    *generation      = reg->generation;
+    return(sp_internal_api_registry_get(api_key.hash, reg));
+}
+
+
+
+//Used to add a new plugin to the registry, returns the lowest free slot without taking it (the add function of the
+//registry takes it once the plugin registers its API). If there is no free slot then we will add new chunks first.
+SPlugin* sp_internal_api_registry_add_new_plugin(APIRegistry *registry)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    uint32 slot = sp_internal_slot_find_free(reg);
+    if(slot == (uint32)reg->capacity)
+    {
+        sp_internal_registry_grow(reg, reg->capacity*SP_REGISTRY_GROWTH_FACTOR);
+        slot = sp_internal_slot_find_free(reg);
+    }
+    return(sp_internal_registry_slot(reg, slot));
+}
+
+//The size is checked along with the write time, while the file is being written the size keeps changing
+//even when the write time has not (or has not yet) moved.
+bool32 sp_internal_win32_plugin_modified(SPlugin *plugin)
+{
+    FILETIME last_write_time = {};
+    GetFileTime(plugin->file_handle,0,0,&last_write_time);
+    LARGE_INTEGER file_size = {};
+    GetFileSizeEx(plugin->file_handle, &file_size);
+    
+    bool32 modified = CompareFileTime(&plugin->last_write_time,&last_write_time) || plugin->file_size != file_size.QuadPart;
+    if(modified)
+    {
+        plugin->last_write_time = last_write_time;
+        plugin->file_size = file_size.QuadPart;
+    }
+
+    return(modified);
+}
+
+bool32 sp_internal_plugin_modified(SPlugin *plugin)
+{
+    
+    #ifdef _WIN32
+        bool32 result = sp_internal_win32_plugin_modified(plugin);
+    #else   
+        //@TODO: Other OS
+        #error NO OTHER OS DEFINED    
+    #endif //_WIN32
+
+    return(result);
+}
+
+//Forward declare.
+inline int64 sp_internal_win32_get_time_us();
+bool32 sp_internal_win32_reload_plugin(SPlugin* plugin, int32 index, APIRegistry *registry);
+internal void sp_internal_win32_reload_job_start(APIRegistry *reg, SPlugin *plugin, int32 index);
+internal bool32 sp_internal_win32_reload_jobs_update(APIRegistry *reg, int64 deadline_us = INT64_MAX);
+internal void sp_internal_win32_reload_job_cancel(APIRegistry *reg, SPlugin *plugin);
+
+
+bool32 sp_internal_reload_plugin(SPlugin* plugin, int32 index, APIRegistry *registry)
+{
+     #ifdef _WIN32
+        bool32 result = sp_internal_win32_reload_plugin(plugin, index, registry);
+    #else   
+        //@TODO: Other OS
+        #error NO OTHER OS DEFINED    
+    #endif //_WIN32
+
+    return(result);
+}
+
+//A modified plugin is not reloaded right away, it is marked as pending and sp_internal_api_registry_reload_settled
+//reloads it once its file stops changing.
+internal bool32
+sp_internal_api_registry_reload_if_modified(APIRegistry *reg, SPlugin *plugin)
+{
+    if(sp_internal_plugin_modified(plugin))
+    {
+        if(!plugin->reload_pending)
+        {
+            printf("Plugin at index : %d has been modified!\n", plugin->reloadable_index);
+        }
+        plugin->reload_pending = true;
+        plugin->last_change_us = sp_internal_win32_get_time_us();
+        reg->reload_pending = true;
+    }
+    //Nothing has been reloaded yet.
+    return(false);
+}
+
+//The file watcher only tells us about the first write, so pending plugins are checked directly until they settle.
+//Pending plugins are reloaded as one batch once every one of them has been quiet for its debounce time,
+//a build that writes several plugins only triggers one round of reloads.
+//With a deadline, reloads that would not finish before it are left pending for the next call (the first one always runs).
+//The next call starts at the first deferred plugin, so plugins late in reloadable_plugins are not starved by earlier ones.
+internal bool32
+sp_internal_api_registry_reload_settled(APIRegistry *reg, int64 deadline_us = INT64_MAX)
+{
+    if(!reg->reload_pending)
+    {
+        return(false);
+    }
+
+    int64 now = sp_internal_win32_get_time_us();
+    bool32 settled = true;
+    uint32 count = reg->reloadable_count;
+    for(uint32 index = 0; index < count; ++index)
+    {
+        SPlugin *plugin = reg->reloadable_plugins[index];
+        if(!plugin->reload_pending)
+        {
+            continue;
+        }
+        if(sp_internal_plugin_modified(plugin))
+        {
+            plugin->last_change_us = now;
+        }
+        if((now - plugin->last_change_us) < plugin->reload_debounce_us)
+        {
+            settled = false;
+        }
+    }
+    if(!settled)
+    {
+        return(false);
+    }
+
+    SP_TRACE_SCOPE("reload_batch", 0);
+    bool32 result = false;
+    bool32 deferred = false;
+    reg->reload_pending = false;
+    if(reg->reload_cursor >= count)
+    {
+        reg->reload_cursor = 0; //plugins were unloaded
+    }
+    uint32 start = reg->reload_cursor;
+    reg->reload_cursor = 0;
+    for(uint32 step = 0; step < count; ++step)
+    {
+        uint32 index = (start + step) % count;
+        SPlugin *plugin = reg->reloadable_plugins[index];
+        if(!plugin->reload_pending)
+        {
+            continue;
+        }
+
+        #ifdef SP_ASYNC_RELOAD
+        //The new version is swapped in by sp_internal_win32_reload_jobs_update once it is ready.
+        plugin->reload_pending = false;
+        sp_internal_win32_reload_job_start(reg, plugin, index);
+        #else
+        if(result && deadline_us - sp_internal_win32_get_time_us() < plugin->reload_cost_us)
+        {
+            //Deferred, it is already settled so the next call starts with it.
+            if(!deferred)
+            {
+                reg->reload_cursor = index;
+                deferred = true;
+            }
+            reg->reload_pending = true;
+            continue;
+        }
+        plugin->reload_pending = false;
+        result |= sp_internal_reload_plugin(plugin, index, reg);
+        #endif //SP_ASYNC_RELOAD
+    }
+    return(result);
+}
+
+//Checks every reloadable plugin, or only the ones in watch_dir if it is not -1.
+internal bool32
+sp_internal_api_registry_poll_reloadable_plugins(APIRegistry *reg, int32 watch_dir = -1)
+{
+    bool32 result = false;
+    uint32 count = reg->reloadable_count;
+    for(uint32 index = 0; index < count; ++index)
+    {
+        SPlugin *plugin = reg->reloadable_plugins[index];
+        if(watch_dir == -1 || plugin->watch_dir == watch_dir)
+        {
+            result |= sp_internal_api_registry_reload_if_modified(reg, plugin);
+        }
+    }
+    return(result);
+}
+
+//Checks reloadable plugins round robin, starting where the last call stopped, until the deadline (at least one is checked).
+//Returns how many are left to check in this round.
+internal uint32
+sp_internal_api_registry_poll_budgeted(APIRegistry *reg, int64 deadline_us)
+{
+    uint32 count = reg->reloadable_count;
+    if(reg->poll_cursor >= count)
+    {
+        reg->poll_cursor = 0; //plugins were unloaded, the round starts over
+    }
+    while(reg->poll_cursor < count)
+    {
+        sp_internal_api_registry_reload_if_modified(reg, reg->reloadable_plugins[reg->poll_cursor++]);
+        if(sp_internal_win32_get_time_us() >= deadline_us)
+        {
+            break;
+        }
+    }
+    uint32 remaining = count - reg->poll_cursor;
+    if(!remaining)
+    {
+        reg->poll_cursor = 0;
+    }
+    return(remaining);
+}
+
+// File Watcher ----------------------------------------------------
+//Instead of asking every reloadable plugin for its last write time on every sp_update, we ask windows to tell us
+//when something is written in the directories the plugins live in (ReadDirectoryChangesW with overlapped IO).
+//When nothing changed sp_update only looks at the OVERLAPPED of each directory, which is not a syscall.
+//If a directory can not be watched, or we fail to re-arm the watch, we fall back to polling every plugin.
+
+#define SP_WATCHER_BUFFER_SIZE KiloBytes(16)
+
+struct SPWatchDir
+{
+    HANDLE dir_handle;
+    OVERLAPPED overlapped;
+    char path[MAX_PATH];
+    DWORD buffer[SP_WATCHER_BUFFER_SIZE / sizeof(DWORD)]; //ReadDirectoryChangesW needs it DWORD aligned
+};
+
+struct SPWatcher
+{
+    //Pointers, since the OVERLAPPED and buffer of a pending read must not move.
+    SPWatchDir **dirs;
+    uint32 dir_count;
+    bool32 poll_all;
+
+    //Watched plugins by directory and file name, chained trough SPlugin::next_watched.
+    //A notification finds its plugin without looking at the other reloadable plugins.
+    SPlugin **buckets;
+    uint32 bucket_count; //always a power of two
+    uint32 watched_count;
+};
+
+//File names are hashed lower case, the file system is not case sensitive.
+internal uint64
+sp_internal_hash_file_name(char* file_name)
+{
+    uint32 hash = 5381;
+    int c;
+    while (c = *file_name++){
+        if(c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+        hash = ((hash << 5) + hash) + c;
+    }
+    return(hash);
+}
+
+internal bool32
+sp_internal_win32_watch_dir_arm(SPWatchDir *dir)
+{
+    dir->overlapped = {};
+    DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE;
+    bool32 result = ReadDirectoryChangesW(dir->dir_handle, dir->buffer, sizeof(dir->buffer), FALSE, filter, 0, &dir->overlapped, 0);
+    return(result);
+}
+
+//Starts watching the directory of a reloadable plugin, if we are not already.
+inline uint32
+sp_internal_watch_bucket(int32 watch_dir, uint64 file_hash, uint32 bucket_count)
+{
+    return(sp_internal_index_bucket(file_hash ^ ((uint64)(uint32)watch_dir << 32), bucket_count));
+}
+
+internal void
+sp_internal_watcher_insert(APIRegistry *reg, SPWatcher *watcher, SPlugin *plugin)
+{
+    if(watcher->watched_count >= watcher->bucket_count)
+    {
+        uint32 bucket_count = watcher->bucket_count ? watcher->bucket_count * 2 : 16;
+        SPlugin **buckets = (SPlugin**)sp_internal_registry_allocate(reg, sizeof(SPlugin*) * bucket_count);
+        memset(buckets, 0, sizeof(SPlugin*) * bucket_count);
+        for(uint32 index = 0; index < watcher->bucket_count; ++index)
+        {
+            SPlugin *watched = watcher->buckets[index];
+            while(watched)
+            {
+                SPlugin *next = watched->next_watched;
+                uint32 bucket = sp_internal_watch_bucket(watched->watch_dir, watched->file_hash, bucket_count);
+                watched->next_watched = buckets[bucket];
+                buckets[bucket] = watched;
+                watched = next;
+            }
+        }
+        sp_internal_registry_free(reg, watcher->buckets);
+        watcher->buckets      = buckets;
+        watcher->bucket_count = bucket_count;
+    }
+
+    uint32 bucket = sp_internal_watch_bucket(plugin->watch_dir, plugin->file_hash, watcher->bucket_count);
+    plugin->next_watched = watcher->buckets[bucket];
+    watcher->buckets[bucket] = plugin;
+    watcher->watched_count++;
+}
+
+internal void
+sp_internal_watcher_remove(SPWatcher *watcher, SPlugin *plugin)
+{
+    if(!watcher->bucket_count)
+    {
+        return;
+    }
+    uint32 bucket = sp_internal_watch_bucket(plugin->watch_dir, plugin->file_hash, watcher->bucket_count);
+    for(SPlugin **at = &watcher->buckets[bucket]; *at; at = &(*at)->next_watched)
+    {
+        if(*at == plugin)
+        {
+            *at = plugin->next_watched;
+            plugin->next_watched = nullptr;
+            watcher->watched_count--;
+            return;
+        }
+    }
+}
+
+internal void
+sp_internal_win32_watcher_add_plugin(APIRegistry *reg, SPlugin *plugin, char* plugin_name)
+{
+    char full_path[MAX_PATH];
+    char *file_part = nullptr;
+    plugin->watch_dir = -1;
+    if(!GetFullPathNameA(plugin_name, MAX_PATH, full_path, &file_part) || !file_part)
+    {
+        //Without a path we can only poll.
+        plugin->file_hash = sp_internal_hash_file_name(plugin_name);
+        reg->watcher->poll_all = true;
+        return;
+    }
+    plugin->file_hash = sp_internal_hash_file_name(file_part);
+    *file_part = '\0'; //full_path is now the directory
+
+    SPWatcher *watcher = reg->watcher;
+    for(uint32 index = 0; index < watcher->dir_count; ++index)
+    {
+        if(_stricmp(watcher->dirs[index]->path, full_path) == 0)
+        {
+            plugin->watch_dir = index;
+            sp_internal_watcher_insert(reg, watcher, plugin);
+            return;
+        }
+    }
+
+    SPWatchDir *dir = (SPWatchDir*)sp_internal_registry_allocate(reg, sizeof(SPWatchDir));
+    memset(dir, 0, sizeof(SPWatchDir));
+    strcpy(dir->path, full_path);
+    dir->dir_handle = CreateFileA(full_path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, 0);
+    if(dir->dir_handle == INVALID_HANDLE_VALUE || !sp_internal_win32_watch_dir_arm(dir))
+    {
+        //@TODO: Log could not watch the plugin directory.
+        if(dir->dir_handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(dir->dir_handle);
+        }
+        sp_internal_registry_free(reg, dir);
+        watcher->poll_all = true;
+        return;
+    }
+
+    watcher->dirs = (SPWatchDir**)sp_internal_registry_reallocate(reg, watcher->dirs, sizeof(SPWatchDir*) * (watcher->dir_count + 1));
+    watcher->dirs[watcher->dir_count] = dir;
+    plugin->watch_dir = watcher->dir_count++;
+    sp_internal_watcher_insert(reg, watcher, plugin);
+}
+
+//Goes trough the notifications of a directory and checks the reloadable plugins whose file was written to.
+internal bool32
+sp_internal_win32_watcher_dispatch(APIRegistry *reg, SPWatchDir *dir, int32 watch_dir)
+{
+    bool32 result = false;
+    uint8 *at = (uint8*)dir->buffer;
+    for(;;)
+    {
+        FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION*)at;
+        if(info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+        {
+            char file_name[MAX_PATH];
+            int32 length = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR),
+                                               file_name, MAX_PATH - 1, 0, 0);
+            file_name[length] = '\0';
+            uint64 file_hash = sp_internal_hash_file_name(file_name);
+
+            SPWatcher *watcher = reg->watcher;
+            uint32 bucket = sp_internal_watch_bucket(watch_dir, file_hash, watcher->bucket_count);
+            for(SPlugin *plugin = watcher->buckets[bucket]; plugin; plugin = plugin->next_watched)
+            {
+                if(plugin->watch_dir == watch_dir && plugin->file_hash == file_hash)
+                {
+                    //One write usually shows up as a few notifications, the last write time check makes sure we only mark it once.
+                    result |= sp_internal_api_registry_reload_if_modified(reg, plugin);
+                }
+            }
+        }
+        if(!info->NextEntryOffset)
+        {
             break;
         }
+        at += info->NextEntryOffset;
+    }
+    return(result);
+}
+
+internal bool32
+sp_internal_win32_watcher_check(APIRegistry *reg)
+{
+    SPWatcher *watcher = reg->watcher;
+    SP_Assert(!watcher->poll_all); //polled by sp_internal_api_registry_check_reloadable_plugins
+
+    bool32 result = false;
+    for(uint32 index = 0; index < watcher->dir_count; ++index)
+    {
+        SPWatchDir *dir = watcher->dirs[index];
+        if(!HasOverlappedIoCompleted(&dir->overlapped))
+        {
+            continue; //Nothing happened in this directory.
+        }
+
+        DWORD bytes = 0;
+        if(GetOverlappedResult(dir->dir_handle, &dir->overlapped, &bytes, FALSE) && bytes)
+        {
+            result |= sp_internal_win32_watcher_dispatch(reg, dir, index);
+        }
+        else
+        {
+            //The buffer overflowed and the notifications were lost, check every plugin in this directory.
+            result |= sp_internal_api_registry_poll_reloadable_plugins(reg, index);
+        }
+
+        if(!sp_internal_win32_watch_dir_arm(dir))
+        {
+            watcher->poll_all = true;
+        }
+    }
+    return(result);
+}
+
+internal void
+sp_internal_win32_watcher_destroy(APIRegistry *reg, SPWatcher *watcher)
+{
+    for(uint32 index = 0; index < watcher->dir_count; ++index)
+    {
+        SPWatchDir *dir = watcher->dirs[index];
+        //Wait for the cancelled read to finish before freeing the buffer it writes to.
+        DWORD bytes = 0;
+        CancelIo(dir->dir_handle);
+        GetOverlappedResult(dir->dir_handle, &dir->overlapped, &bytes, TRUE);
+        CloseHandle(dir->dir_handle);
+        sp_internal_registry_free(reg, dir);
+    }
+    sp_internal_registry_free(reg, watcher->dirs);
+    sp_internal_registry_free(reg, watcher->buckets);
+    sp_internal_registry_free(reg, watcher);
+}
+
+// End File Watcher ----------------------------------------------------
+
+//Looks for modified plugins and reloads the ones that have settled.
+//With a deadline, polling and reloading stop once it is reached. unchecked receives how many plugins are left to poll.
+bool32 sp_internal_api_registry_check_reloadable_plugins(APIRegistry *registry, int64 deadline_us = INT64_MAX, uint32 *unchecked = nullptr)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    uint32 remaining = 0;
+    if(reg->watcher && !reg->watcher->poll_all)
+    {
+        sp_internal_win32_watcher_check(reg);
+    }
+    else if(deadline_us == INT64_MAX)
+    {
+        sp_internal_api_registry_poll_reloadable_plugins(reg);
+    }
+    else
+    {
+        remaining = sp_internal_api_registry_poll_budgeted(reg, deadline_us);
+    }
+    if(unchecked)
+    {
+        *unchecked = remaining;
+    }
+    return(sp_internal_api_registry_reload_settled(reg, deadline_us));
+}
+
+
+internal bool32
+sp_internal_update(APIRegistry *registry, int64 deadline_us, uint32 *outstanding)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    SP_TRACE_SCOPE("sp_update", 0);
+    #ifdef SP_ENABLE_STATS
+    int64 start_time = sp_internal_win32_get_time_us();
+    #endif //SP_ENABLE_STATS
+    bool32 result = false;
+    if(reg->reloaded_count)
+    {
+        reg->reloaded_count = 0;
+    }
+    sp_internal_registry_reclaim(reg);
+    #ifdef SP_ASYNC_RELOAD
+    if(reg->pending_reload_count)
+    {
+        result = sp_internal_win32_reload_jobs_update(reg, deadline_us);
+    }
+    #endif //SP_ASYNC_RELOAD
+    uint32 unchecked = 0;
+    result |= sp_internal_api_registry_check_reloadable_plugins(reg, deadline_us, &unchecked);
+    sp_internal_registry_publish(reg);
+
+    if(outstanding)
+    {
+        uint32 waiting = 0;
+        if(reg->reload_pending)
+        {
+            for(uint32 index = 0; index < reg->reloadable_count; ++index)
+            {
+                waiting += reg->reloadable_plugins[index]->reload_pending ? 1 : 0;
+            }
+        }
+        #ifdef SP_ASYNC_RELOAD
+        waiting += reg->pending_reload_count;
+        #endif //SP_ASYNC_RELOAD
+        *outstanding = unchecked + waiting;
+    }
+
+    #ifdef SP_ENABLE_STATS
+    SPRegistryStats *stats = &reg->stats;
+    stats->update_count++;
+    stats->last_update_us   = sp_internal_win32_get_time_us() - start_time;
+    stats->total_update_us += stats->last_update_us;
+    if(stats->last_update_us > stats->max_update_us)
+    {
+        stats->max_update_us = stats->last_update_us;
+    }
+    #endif //SP_ENABLE_STATS
+
+    return(result);
+}
+
+bool32 sp_update(APIRegistry *registry)
+{
+    return(sp_internal_update(registry, INT64_MAX, nullptr));
+}
+
+bool32 sp_update()
+{
+    return(sp_update(nullptr));
+}
+
+bool32 sp_update_budgeted(APIRegistry *registry, uint32 budget_us, uint32 *outstanding)
+{
+    return(sp_internal_update(registry, sp_internal_win32_get_time_us() + budget_us, outstanding));
+}
+
+bool32 sp_update_budgeted(uint32 budget_us, uint32 *outstanding)
+{
+    return(sp_update_budgeted(nullptr, budget_us, outstanding));
+}
+
+void sp_set_reload_debounce(SPlugin *plugin, uint32 milliseconds)
+{
+    SP_Assert(plugin && plugin->reloadable);
+    plugin->reload_debounce_us = (int64)milliseconds * 1000;
+}
+
+uint32 sp_get_reloaded_plugins(APIRegistry *registry, SPlugin **plugins, uint32 max_plugins)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    if(plugins)
+    {
+        uint32 count = reg->reloaded_count < max_plugins ? reg->reloaded_count : max_plugins;
+        for(uint32 index = 0; index < count; ++index)
+        {
+            plugins[index] = reg->reloaded_plugins[index];
+        }
     }
+    return(reg->reloaded_count);
+}
 
+uint32 sp_get_reloaded_plugins(SPlugin **plugins, uint32 max_plugins)
+{
+    return(sp_get_reloaded_plugins(nullptr, plugins, max_plugins));
 }
 
-void sp_internal_plugin_cleanup(SPlugin *plugin)
+uint64 sp_get_generation(APIRegistry *registry)
 {
-    #ifdef _WIN32
-        CloseHandle(plugin->file_handle);
-        FreeLibrary(plugin->library_handle);
-    #else
-        //@TODO: Do other OS
-        #error NO OTHER OS DEFINED
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+    return((uint64)reg->generation);
+}
 
-    #endif //_WIN32
+uint64 sp_get_generation()
+{
+    return(sp_get_generation(nullptr));
 }
 
-void sp_internal_api_registry_remove(char* api_name, bool32 reload, APIRegistry *registry)
+uint64 sp_get_api_generation(SPlugin *plugin)
+{
+    return(plugin->api_generation);
+}
+
+#ifdef SP_ENABLE_STATS
+uint32 sp_get_stats(APIRegistry *registry, SPRegistryStats *registry_stats, SPPluginStats *plugin_stats, uint32 max_plugin_stats)
 {
-    //@TODO: Make sure to close the file_handle (win32) if this was a reloadable plugin.
     APIRegistry *reg = registry;
     if(!reg)
     {
         reg = sp_internal_registry_get();
     }
 
-    uint64 desired_api_hash = SP_HASH(api_name);
+    if(registry_stats)
+    {
+        *registry_stats = reg->stats;
+        registry_stats->plugin_count = reg->used;
+    }
 
-    if(reload)
+    uint32 count = 0;
+    for(uint32 index = 0; plugin_stats && index < (uint32)reg->capacity && count < max_plugin_stats; ++index)
     {
-        sp_internal_api_registry_remove_reloaded(desired_api_hash, reg);
+        if(!reg->plugin_apis[index])
+        {
+            continue;
+        }
+        SPlugin *plugin = sp_internal_registry_slot(reg, index);
+        SPPluginStats *stats = &plugin_stats[count++];
+        *stats = plugin->stats;
+        stats->api_hash = reg->plugin_api_hashes[index];
+        stats->handle.index      = plugin->index;
+        stats->handle.generation = plugin->generation;
     }
-    else
+    return(count);
+}
+
+uint32 sp_get_stats(SPRegistryStats *registry_stats, SPPluginStats *plugin_stats, uint32 max_plugin_stats)
+{
+    return(sp_get_stats(nullptr, registry_stats, plugin_stats, max_plugin_stats));
+}
+#endif //SP_ENABLE_STATS
+
+void sp_registry_destroy(APIRegistry *registry)
+{
+    if(!registry)
+    {
+        registry = sp_internal_registry_get();
+    }
+    uint32 count = registry->capacity;
+    for(uint32 index = 0; index < count; ++index)
+    {
+        SPlugin *plugin = sp_internal_registry_slot(registry, index);
+        unload_func unload_function = (unload_func)plugin->unload_func;
+        sp_internal_win32_reload_job_cancel(registry, plugin);
+        if(unload_function)
+        {
+            unload_function(registry, false);
+            sp_internal_plugin_cleanup(registry, plugin);
+        }
+    }
+    for(uint32 chunk_index = 0; chunk_index < registry->chunk_count; ++chunk_index)
+    {
+        sp_internal_registry_free(registry, registry->plugin_chunks[chunk_index]);
+    }
+    sp_internal_registry_free(registry, registry->plugin_chunks);
+    sp_internal_registry_free(registry, registry->plugin_api_hashes);
+    sp_internal_registry_free(registry, registry->plugin_apis);
+    sp_internal_registry_free(registry, registry->free_slots);
+    sp_internal_registry_free(registry, registry->index);
+    sp_internal_registry_free(registry, registry->pending_reloads);
+    sp_internal_registry_free(registry, registry->reloadable_plugins);
+    //Readers must be done by now, so everything that was retired can go.
+    SPReaders *readers = registry->readers;
+    for(uint32 index = 0; index < readers->retired_count; ++index)
+    {
+        sp_internal_free_retired(registry, readers->retired[index].type, readers->retired[index].ptr);
+    }
+    sp_internal_registry_free(registry, readers->retired);
+    sp_internal_registry_free(registry, readers);
+    sp_internal_registry_free(registry, registry->read_view);
+    sp_internal_registry_free(registry, registry->lazy_plugins);
+    //States of plugins that never registered an api.
+    for(uint32 index = 0; index < registry->state_count; ++index)
+    {
+        sp_internal_registry_free(registry, registry->states[index].block);
+        sp_internal_registry_free(registry, registry->states[index].previous);
+    }
+    sp_internal_registry_free(registry, registry->states);
+    sp_internal_registry_free(registry, registry->reloaded_plugins);
+    sp_internal_trampolines_destroy(registry);
+    if(registry->watcher)
+    {
+        sp_internal_win32_watcher_destroy(registry, registry->watcher);
+    }
+    *registry = {};
+    //Threads might have cached APIs of this registry, and a new one could be created at the same address.
+    InterlockedIncrement64(&sp_global_epoch.value);
+}
+//
+//End API Registry ----------------------------------------------------
+
+
+
+// Plugin Functions
+
+// Module Copies ----------------------------------------------------
+//Windows does not let anyone write to a dll while it is loaded, so a reloadable plugin is loaded from a temp copy
+//(plugin_tempN.dll) and the compiler is free to write the original. Plugins that are not reloadable are loaded in place.
+//On volumes that support block cloning (ReFS, Dev Drive) the copy shares the data of the original instead of
+//duplicating it, so it takes the same time no matter how big the plugin is. Otherwise we fall back to CopyFile.
+//A copy is deleted as soon as the module loaded from it is freed, copies left behind by a previous run are deleted
+//the next time the plugin is loaded.
+
+internal bool32
+sp_internal_win32_clone_file(char *source_name, char *dest_name)
+{
+    bool32 result = false;
+    #ifdef FSCTL_DUPLICATE_EXTENTS_TO_FILE
+    HANDLE source = CreateFileA(source_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+    if(source == INVALID_HANDLE_VALUE)
+    {
+        return(false);
+    }
+
+    DWORD file_system_flags = 0;
+    LARGE_INTEGER file_size = {};
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity = {};
+    DWORD bytes = 0;
+    if(GetVolumeInformationByHandleW(source, 0, 0, 0, 0, &file_system_flags, 0, 0) &&
+       (file_system_flags & FILE_SUPPORTS_BLOCK_REFCOUNTING) &&
+       GetFileSizeEx(source, &file_size) &&
+       DeviceIoControl(source, FSCTL_GET_INTEGRITY_INFORMATION, 0, 0, &integrity, sizeof(integrity), &bytes, 0))
     {
-        SPlugin *plugin = reg->plugins;
-        uint32 count   = reg->capacity; 
-        for(uint32 index = 0; index < count; ++index )
+        HANDLE dest = CreateFileA(dest_name, GENERIC_READ | GENERIC_WRITE | DELETE, 0, 0, CREATE_ALWAYS, 0, source);
+        if(dest != INVALID_HANDLE_VALUE)
         {
-            plugin = &reg->plugins[index];
-            if(desired_api_hash == plugin->api_hash)
+            //Both files must have the same integrity settings and the destination must already be big enough.
+            FSCTL_SET_INTEGRITY_INFORMATION_BUFFER set_integrity = {};
+            set_integrity.ChecksumAlgorithm = integrity.ChecksumAlgorithm;
+            set_integrity.Flags = integrity.Flags;
+            FILE_END_OF_FILE_INFO end_of_file = {};
+            end_of_file.EndOfFile = file_size;
+
+            result = DeviceIoControl(dest, FSCTL_SET_INTEGRITY_INFORMATION, &set_integrity, sizeof(set_integrity), 0, 0, &bytes, 0) &&
+                     SetFileInformationByHandle(dest, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file));
+
+            //Clone ranges must be a multiple of the cluster size, the last one can go past the end of the file.
+            int64 cluster_size = integrity.ClusterSizeInBytes;
+            int64 clone_size   = ((file_size.QuadPart + cluster_size - 1) / cluster_size) * cluster_size;
+            int64 max_chunk    = (int64)1 << 30;
+            for(int64 offset = 0; result && offset < clone_size; offset += max_chunk)
             {
-                reg->curr = &reg->plugins[index];
-                break;
+                DUPLICATE_EXTENTS_DATA extents = {};
+                extents.FileHandle = source;
+                extents.SourceFileOffset.QuadPart = offset;
+                extents.TargetFileOffset.QuadPart = offset;
+                extents.ByteCount.QuadPart = (clone_size - offset) < max_chunk ? (clone_size - offset) : max_chunk;
+                result = DeviceIoControl(dest, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), 0, 0, &bytes, 0);
+            }
+
+            if(!result)
+            {
+                FILE_DISPOSITION_INFO disposition = {};
+                disposition.DeleteFile = TRUE;
+                SetFileInformationByHandle(dest, FileDispositionInfo, &disposition, sizeof(disposition));
             }
+            CloseHandle(dest);
         }
     }
-    reg->used--;
+    CloseHandle(source);
+    #endif //FSCTL_DUPLICATE_EXTENTS_TO_FILE
+    return(result);
 }
 
-void * sp_internal_api_registry_get(uint64 api_hash, APIRegistry *registry)
+internal bool32
+sp_internal_win32_copy_module_file(char *source_name, char *dest_name)
 {
-    APIRegistry *reg = registry;
-    if(!reg)
+    if(sp_internal_win32_clone_file(source_name, dest_name))
     {
-        reg = sp_internal_registry_get();
+        return(true);
+    }
+    return(CopyFile(source_name, dest_name, 0));
+}
+
+//Frees a module that was loaded from a temp copy and deletes the copy.
+internal void
+sp_internal_win32_free_module_copy(HMODULE module)
+{
+    if(!module)
+    {
+        return;
+    }
+    SP_TRACE_SCOPE("free_module", 0);
+    #ifdef SP_KEEP_MODULE_COPIES
+    FreeLibrary(module);
+    #else
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(module, path, MAX_PATH);
+    FreeLibrary(module);
+    if(length && length < MAX_PATH)
+    {
+        //Fails if the copy is still loaded somewhere else, that is fine.
+        DeleteFileA(path);
     }
+    #endif //SP_KEEP_MODULE_COPIES
+}
+
+//Deletes the temp copies of a plugin that a previous run left behind. Copies that are still loaded can not be deleted.
+internal void
+sp_internal_win32_delete_stale_copies(char *plugin_name)
+{
+    StrBuffer pattern = {};
+    sp_string_build_tmp_pattern(plugin_name, &pattern);
 
-    uint64 desired_api_hash = api_hash;
-    SPlugin *plugin = reg->plugins;
-    uint32 count   = reg->capacity; 
-    for(uint32 index = 0; index < count; ++index )
+    //The pattern only matches file names, put the directory of the plugin back in front.
+    char *directory_end = plugin_name;
+    for(char *c = plugin_name; *c; ++c)
     {
-        plugin = &reg->plugins[index];
-        if(desired_api_hash == plugin->api_hash)
+        if(*c == '\\' || *c == '/')
         {
-            return(plugin->api);
+            directory_end = c + 1;
         }
+    }
 
+    WIN32_FIND_DATAA find_data = {};
+    HANDLE find = FindFirstFileA(pattern.buffer, &find_data);
+    if(find == INVALID_HANDLE_VALUE)
+    {
+        return;
     }
-    return(0);
+    do
+    {
+        StrBuffer path = {};
+        for(char *c = plugin_name; c != directory_end; ++c)
+        {
+            sp_buffer_append_char(&path, *c);
+        }
+        sp_buffer_append_string(&path, find_data.cFileName);
+        DeleteFileA(path.buffer);
+    } while(FindNextFileA(find, &find_data));
+    FindClose(find);
 }
 
-void * sp_get_api(APIRegistry *registry,char *api_name)
+// End Module Copies ----------------------------------------------------
+
+
+// Loading ----------------------------------------------------
+//Loading a plugin is done in two steps.
+//Opening it (copy the file, have the loader map it and resolve the symbols) is the slow part and does not touch the
+//registry, so it can be done on any thread. Registering it (take a slot, call the plugin's load function) must be done
+//on the thread that owns the registry.
+//sp_load_plugins opens a batch of plugins on the windows thread pool and then registers them in the order they were given.
+
+//Everything that is needed to swap in a new version of a plugin.
+struct SPPreparedModule
 {
-    uint64 api_hash = SP_HASH(api_name);
-    return(sp_internal_api_registry_get(api_hash, registry));
-}
+    HMODULE library_handle;
+    load_func load_function;
+    void* unload_func;
+    char plugin_name[256];
 
-void * sp_get_api(APIRegistry *registry,SPlugin *plugin)
+    #ifdef SP_ENABLE_STATS
+    int64 copy_us;
+    int64 map_us;
+    int64 resolve_us;
+    #endif //SP_ENABLE_STATS
+};
+
+//Loads module_name and finds the load/unload functions of prepared->plugin_name in it.
+internal bool32
+sp_internal_win32_resolve_module(char *module_name, SPPreparedModule *prepared)
 {
-    return(sp_internal_api_registry_get(plugin->api_hash, registry));
+    #ifdef SP_ENABLE_STATS
+    int64 map_start = sp_internal_win32_get_time_us();
+    #endif //SP_ENABLE_STATS
+    {
+        SP_TRACE_SCOPE("map_module", 0);
+        prepared->library_handle = LoadLibraryA(module_name);
+    }
+    if(!prepared->library_handle)
+    {
+        return false;
+        //@TODO: Log could not Load plugin
+    }
+    #ifdef SP_ENABLE_STATS
+    int64 resolve_start = sp_internal_win32_get_time_us();
+    prepared->map_us = resolve_start - map_start;
+    #endif //SP_ENABLE_STATS
+    SP_TRACE_SCOPE("resolve_symbols", 0);
+
+    StrBuffer load_function_name = {};
+    sp_string_build_load_function_name(prepared->plugin_name,&load_function_name);
+    prepared->load_function = (load_func)GetProcAddress(prepared->library_handle,load_function_name.buffer);
+    if(!prepared->load_function)
+    {
+        SP_Assert(!"Could not locate the plugin load function!!!");
+    }
+
+    StrBuffer unload_function_name = {};
+    sp_string_build_unload_function_name(prepared->plugin_name,&unload_function_name);
+    prepared->unload_func = GetProcAddress(prepared->library_handle,unload_function_name.buffer);
+    if(!prepared->unload_func)
+    {
+        SP_Assert(!"Could not locate the plugin UNLOAD function!!!");
+    }
+    #ifdef SP_ENABLE_STATS
+    prepared->resolve_us = sp_internal_win32_get_time_us() - resolve_start;
+    #endif //SP_ENABLE_STATS
+    return true;
 }
 
-void * sp_get_api(char *api_name)
+//Copies the plugin to the temp file the module is loaded from.
+internal bool32
+sp_internal_win32_copy_module(char *plugin_name, char *temp_name, SPPreparedModule *prepared)
 {
-    uint64 api_hash = SP_HASH(api_name);
-    return(sp_internal_api_registry_get(api_hash, nullptr));
+    SP_TRACE_SCOPE("copy_module", 0);
+    #ifdef SP_ENABLE_STATS
+    int64 copy_start = sp_internal_win32_get_time_us();
+    bool32 result = sp_internal_win32_copy_module_file(plugin_name, temp_name);
+    prepared->copy_us = sp_internal_win32_get_time_us() - copy_start;
+    return(result);
+    #else
+    return(sp_internal_win32_copy_module_file(plugin_name, temp_name));
+    #endif //SP_ENABLE_STATS
 }
 
-void * sp_get_api(SPlugin *plugin)
+struct SPLoadRequest
+{
+    char *plugin_name;
+    bool32 reloadable;
+    bool32 opened;
+
+    //Only used by reloadable plugins.
+    HANDLE file_handle;
+    FILETIME last_write_time;
+    int64 file_size;
+
+    SPPreparedModule prepared;
+    SPLoadBatch *batch;
+};
+
+//Does not touch the registry, can be called from any thread.
+internal bool32
+sp_internal_win32_open_plugin(SPLoadRequest *request)
 {
-    return(sp_internal_api_registry_get(plugin->api_hash, nullptr));
+    SP_TRACE_SCOPE("open_plugin", 0);
+    char *plugin_name = request->plugin_name;
+    SPPreparedModule *prepared = &request->prepared;
+    uint32 length = 0;
+    for(; plugin_name[length] && length < (sizeof(prepared->plugin_name) - 1); ++length)
+    {
+        prepared->plugin_name[length] = plugin_name[length];
+    }
+    prepared->plugin_name[length] = '\0';
+
+    if(!request->reloadable)
+    {
+        return(sp_internal_win32_resolve_module(plugin_name, prepared));
+    }
+
+    //Load from a copy so the original can be rebuilt while we are running.
+    sp_internal_win32_delete_stale_copies(plugin_name);
+
+    StrBuffer temp_plugin_name = {};
+    sp_string_build_tmp_name(plugin_name, &temp_plugin_name);
+    if(!sp_internal_win32_copy_module(plugin_name, temp_plugin_name.buffer, prepared))
+    {
+        return false;
+        //@TODO: Log could not COPY plugin to temp_plugin.
+    }
+    if(!sp_internal_win32_resolve_module(temp_plugin_name.buffer, prepared))
+    {
+        DeleteFileA(temp_plugin_name.buffer);
+        return false;
+    }
+
+    //Get the information we need to monitor the plugin.
+    request->file_handle = CreateFile(plugin_name,0,0,0,OPEN_EXISTING,0,0);
+    GetFileTime(request->file_handle,0,0,&request->last_write_time);
+    LARGE_INTEGER file_size = {};
+    GetFileSizeEx(request->file_handle, &file_size);
+    request->file_size = file_size.QuadPart;
+    return true;
 }
 
+//Adds an opened plugin to the registry and calls its load function, this must be called from the thread that owns the registry.
+internal SPlugin *
+sp_internal_win32_register_plugin(APIRegistry *reg, SPLoadRequest *request)
+{
+    SPlugin *plugin = sp_internal_api_registry_add_new_plugin(reg); 
+    plugin->hash = SP_HASH(request->plugin_name);
+    plugin->reloadable = request->reloadable;
+    plugin->library_handle = request->prepared.library_handle;
+    plugin->unload_func = request->prepared.unload_func;
+
+    if(request->reloadable) 
+    {
+        plugin->file_handle = request->file_handle;
+        plugin->last_write_time = request->last_write_time;
+        plugin->file_size = request->file_size;
+        plugin->reload_debounce_us = (int64)SP_RELOAD_DEBOUNCE_MS * 1000;
+        //Add the plugin to the list so the registry can monitor it.
+        if(reg->reloadable_count == reg->reloadable_capacity)
+        {
+            reg->reloadable_capacity = reg->reloadable_capacity ? reg->reloadable_capacity * 2 : 16;
+            reg->reloadable_plugins = (SPlugin**)sp_internal_registry_reallocate(reg, reg->reloadable_plugins, sizeof(SPlugin*) * reg->reloadable_capacity);
+        }
+        plugin->reloadable_index = reg->reloadable_count;
+        reg->reloadable_plugins[reg->reloadable_count++] = plugin;
 
+        #ifndef SP_DISABLE_FILE_WATCHER
+        if(!reg->watcher)
+        {
+            reg->watcher = (SPWatcher*)sp_internal_registry_allocate(reg, sizeof(SPWatcher));
+            *reg->watcher = {};
+        }
+        sp_internal_win32_watcher_add_plugin(reg, plugin, request->plugin_name);
+        #endif //SP_DISABLE_FILE_WATCHER
+    }
 
-//Used to add a new plugin to the registry, if there is enough space all it does is return a 
-//pointer to the curr plugin. If there is not enough space then we will reallocate, copy the old memory
-//and then return a pointer to the new curr.
-SPlugin* sp_internal_api_registry_add_new_plugin(APIRegistry *registry)
+    //call the plugin load function
+    #ifdef SP_ENABLE_STATS
+    int64 load_call_start = sp_internal_win32_get_time_us();
+    #endif //SP_ENABLE_STATS
+    {
+        SP_TRACE_SCOPE("load_function", plugin->index);
+        //Claimed while the load function runs, it could load a lazy plugin (sp_get_api) before it adds its own api.
+        sp_internal_slot_claim(reg, plugin->index);
+        SPlugin *outer_plugin = reg->loading_plugin;
+        reg->loading_plugin = plugin;
+        request->prepared.load_function(reg, false);
+        reg->loading_plugin = outer_plugin;
+        if(!reg->plugin_api_hashes[plugin->index])
+        {
+            sp_internal_slot_release(reg, plugin->index); //it did not register an api
+        }
+    }
+    #ifdef SP_ENABLE_STATS
+    SPPreparedModule *prepared = &request->prepared;
+    plugin->stats = {};
+    plugin->stats.load_us = prepared->copy_us + prepared->map_us + prepared->resolve_us +
+                            (sp_internal_win32_get_time_us() - load_call_start);
+    #endif //SP_ENABLE_STATS
+    return (plugin);
+}
+
+SPlugin * sp_internal_win32_load_plugin(char* plugin_name, bool32 reloadable, APIRegistry *registry = nullptr)
 {
+    SP_TRACE_SCOPE("load_plugin", 0);
     APIRegistry *reg = registry;
     if(!reg)
     {
         reg = sp_internal_registry_get();
     }
 
-    if(reg->used < reg->capacity)
+    SPLoadRequest request = {};
+    request.plugin_name = plugin_name;
+    request.reloadable = reloadable;
+    if(!sp_internal_win32_open_plugin(&request))
     {
-        return(reg->curr);
+        return nullptr;
     }
-    else
+    return(sp_internal_win32_register_plugin(reg, &request));
+}
+
+struct SPLoadBatch
+{
+    APIRegistry *registry;
+    SPLoadRequest *requests;
+    uint32 count;
+    volatile LONG remaining;
+    HANDLE done_event;
+};
+
+internal DWORD WINAPI
+sp_internal_win32_open_plugin_proc(LPVOID param)
+{
+    SPLoadRequest *request = (SPLoadRequest *)param;
+    request->opened = sp_internal_win32_open_plugin(request);
+    if(InterlockedDecrement(&request->batch->remaining) == 0)
     {
-        int32 old_capacity = reg->capacity;
-        reg->capacity = old_capacity*SP_REGISTRY_GROWTH_FACTOR;
+        SetEvent(request->batch->done_event);
+    }
+    return(0);
+}
+
+// End Loading ----------------------------------------------------
+
+
+// Reloading ----------------------------------------------------
+
+inline int64
+sp_internal_win32_get_time_us()
+{
+    local_persist LARGE_INTEGER frequency = {};
+    if(!frequency.QuadPart)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    //Split so counter * 1000000 does not overflow, which it would after a few days of uptime at the usual 10 MHz.
+    int64 seconds   = counter.QuadPart / frequency.QuadPart;
+    int64 remainder = counter.QuadPart % frequency.QuadPart;
+    return(seconds * 1000000 + (remainder * 1000000) / frequency.QuadPart);
+}
+
+#ifdef SP_ENABLE_STATS
+inline void
+sp_internal_plugin_record_stall(SPlugin *plugin, int64 stall_us)
+{
+    plugin->stats.last_stall_us = stall_us;
+    if(stall_us > plugin->stats.max_stall_us)
+    {
+        plugin->stats.max_stall_us = stall_us;
+    }
+}
+#endif //SP_ENABLE_STATS
+
+//Preparing the new version is the slow part of a reload (copy the file, have the loader map it and resolve the symbols)
+//and it does not touch the registry, so it can be done on any thread.
+internal bool32
+sp_internal_win32_prepare_module(HANDLE file_handle, uint32 temp_index, SPPreparedModule *prepared)
+{
+    SP_TRACE_SCOPE("prepare_module", temp_index);
+    char buffer[256];
+    StrBuffer new_plugin_name = {};
+    GetFinalPathNameByHandle(file_handle, buffer, 256, VOLUME_NAME_NONE) ; 
+    sp_string_extract_plugin_name(buffer, prepared->plugin_name);
+    sp_string_build_tmp_name(prepared->plugin_name, &new_plugin_name, temp_index);
+
+    if(!sp_internal_win32_copy_module(prepared->plugin_name, new_plugin_name.buffer, prepared))
+    {
+        return false;
+        //@TODO: Log could not COPY plugin to temp_plugin.
+    }
+
+    if(!sp_internal_win32_resolve_module(new_plugin_name.buffer, prepared))
+    {
+        DeleteFileA(new_plugin_name.buffer);
+        return false;
+    }
+    return true;
+}
 
-        void* alloc_memory = realloc(reg->plugins,sizeof(SPlugin) * reg->capacity);
-        if(!alloc_memory)
+//Swaps a prepared module in for the loaded version of the plugin, this must be called from the thread that owns the registry.
+//Returns the module of the old version, it is up to the caller to free it.
+internal HMODULE
+sp_internal_win32_publish_module(SPlugin *plugin, SPPreparedModule *prepared, APIRegistry *reg)
+{
+    SP_TRACE_SCOPE("publish_module", plugin->index);
+    SPlugin *new_plugin = sp_internal_api_registry_add_new_plugin(reg); 
+    new_plugin->hash = SP_HASH(prepared->plugin_name);
+    new_plugin->reloadable = 1;
+    new_plugin->reload_count = plugin->reload_count + 1;
+    new_plugin->file_handle = plugin->file_handle;
+    new_plugin->last_write_time = plugin->last_write_time;
+    new_plugin->file_size = plugin->file_size;
+    new_plugin->last_change_us = plugin->last_change_us;
+    new_plugin->reload_debounce_us = plugin->reload_debounce_us;
+    new_plugin->reload_pending = plugin->reload_pending;
+    new_plugin->file_hash = plugin->file_hash;
+    new_plugin->watch_dir = plugin->watch_dir;
+    new_plugin->next_watched = plugin->next_watched;
+    new_plugin->reloadable_index = plugin->reloadable_index;
+    new_plugin->reload_job = plugin->reload_job;
+    new_plugin->library_handle = prepared->library_handle;
+    new_plugin->unload_func = prepared->unload_func;
+
+    #ifdef SP_ENABLE_STATS
+    int64 load_call_start = sp_internal_win32_get_time_us();
+    #endif //SP_ENABLE_STATS
+    {
+        SP_TRACE_SCOPE("load_function", plugin->index);
+        sp_internal_slot_claim(reg, new_plugin->index); //released by the reset at the end
+        SPlugin *outer_plugin = reg->loading_plugin;
+        reg->loading_plugin = new_plugin;
+        prepared->load_function(reg, true);
+        reg->loading_plugin = outer_plugin;
+    }
+
+    //The new version got the state of the old one trough SP_GET_STATE in its load function (See [Plugin State]),
+    //it is the same block unless the layout changed.
+
+    HMODULE old_plugin_handle = plugin->library_handle;
+    uint32 generation = plugin->generation;
+    void *old_table = reg->plugin_apis[plugin->index];
+    void **old_trampoline_targets = plugin->trampoline_targets;
+    uint32 old_api_size = plugin->api_size;
+
+    #ifdef SP_ENABLE_STATS
+    //Taken before the unload function, removing the api resets the old slot.
+    //Lookups that other threads count between this copy and the move below are lost, the counters are not exact.
+    SPPluginStats *stats = &new_plugin->stats;
+    *stats = plugin->stats;
+    #endif //SP_ENABLE_STATS
+
+    {
+        SP_TRACE_SCOPE("unload_function", plugin->index);
+        unload_func unload_function = (unload_func)plugin->unload_func;
+        unload_function(reg, true);
+    }
+    sp_internal_state_release_previous(reg, reg->plugin_api_hashes[new_plugin->index]);
+
+    #ifdef SP_ENABLE_STATS
+    stats->reload_count++;
+    stats->last_copy_us      = prepared->copy_us;
+    stats->last_map_us       = prepared->map_us;
+    stats->last_resolve_us   = prepared->resolve_us;
+    stats->last_load_call_us = sp_internal_win32_get_time_us() - load_call_start;
+    stats->last_reload_us    = stats->last_copy_us + stats->last_map_us + stats->last_resolve_us + stats->last_load_call_us;
+    stats->total_reload_us  += stats->last_reload_us;
+    if(stats->last_reload_us > stats->max_reload_us)
+    {
+        stats->max_reload_us = stats->last_reload_us;
+    }
+    #endif //SP_ENABLE_STATS
+
+    //Move the new version into the slot of the old one, this way pointers and handles to the plugin
+    //(and reloadable_plugins[index]) stay valid across the reload.
+    //The generation is kept since this is still the same plugin.
+    uint32 slot = plugin->index;
+    *plugin = *new_plugin;
+    plugin->index      = slot;
+    plugin->generation = generation;
+    reg->plugin_api_hashes[slot] = reg->plugin_api_hashes[new_plugin->index];
+    reg->plugin_apis[slot]       = reg->plugin_apis[new_plugin->index];
+    sp_internal_index_insert(reg, reg->plugin_api_hashes[slot], (int32)slot);
+    sp_internal_slot_claim(reg, slot); //freed when the old version removed its api
+    sp_internal_plugin_reset(reg, new_plugin);
+
+    if(reg->plugin_apis[slot] != old_table)
+    {
+        //The api struct changed size and got a new table. The old one can only go once no view points at it.
+        sp_internal_registry_publish(reg);
+        sp_internal_registry_retire(reg, SP_RETIRE_MEMORY, old_table);
+        if(old_trampoline_targets)
         {
-            SP_Assert(!"Could not reallocate block");
+            sp_internal_trampolines_release(reg, old_trampoline_targets, old_api_size);
         }
-        reg->plugins = (SPlugin *)alloc_memory;
-        size_t new_chunk_byte_size = sizeof(SPlugin) * (reg->capacity - old_capacity);
-        memset(reg->plugins + old_capacity, 0, new_chunk_byte_size);
-
-        reg->curr = reg->plugins + reg->used;
+    }
 
-        return(reg->curr);
+    reg->generation_dirty = true;
+    if(reg->reloaded_count == reg->reloaded_capacity)
+    {
+        reg->reloaded_capacity = reg->reloaded_capacity ? reg->reloaded_capacity * 2 : 8;
+        reg->reloaded_plugins = (SPlugin**)sp_internal_registry_reallocate(reg, reg->reloaded_plugins, sizeof(SPlugin*) * reg->reloaded_capacity);
     }
+    reg->reloaded_plugins[reg->reloaded_count++] = plugin;
+
+    return(old_plugin_handle);
 }
 
-bool32 sp_internal_win32_plugin_modified(SPlugin *plugin)
+bool32 sp_internal_win32_reload_plugin(SPlugin* plugin, int32 index, APIRegistry* registry)
 {
-    FILETIME last_write_time = {};
-    GetFileTime(plugin->file_handle,0,0,&last_write_time);
+    SP_TRACE_SCOPE("reload_plugin", index);
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
     
-    bool32 modified = CompareFileTime(&plugin->last_write_time,&last_write_time);
-    if(modified)
+    }
+
+    int64 start_time = sp_internal_win32_get_time_us();
+
+    //Load the new plugin
+    SPPreparedModule prepared = {};
+    if(!sp_internal_win32_prepare_module(plugin->file_handle, plugin->reload_count + 1, &prepared))
     {
-        plugin->last_write_time = last_write_time;
+        #ifdef SP_ENABLE_STATS
+        plugin->stats.failed_reloads++;
+        #endif //SP_ENABLE_STATS
+        return false;
     }
+    HMODULE old_plugin_handle = sp_internal_win32_publish_module(plugin, &prepared, reg);
+    sp_internal_registry_retire(reg, SP_RETIRE_MODULE_COPY, old_plugin_handle);
 
-    return(modified);
+    int64 end_time = sp_internal_win32_get_time_us();
+    plugin->reload_cost_us = end_time - start_time;
+    #ifdef SP_ENABLE_STATS
+    sp_internal_plugin_record_stall(plugin, end_time - start_time);
+    #endif //SP_ENABLE_STATS
+
+    return true;
 }
 
-bool32 sp_internal_plugin_modified(SPlugin *plugin)
-{
-    
-    #ifdef _WIN32
-        bool32 result = sp_internal_win32_plugin_modified(plugin);
-    #else   
-        //@TODO: Other OS
-        #error NO OTHER OS DEFINED    
-    #endif //_WIN32
+// Background Reloading (SP_ASYNC_RELOAD) ----------------------------------------------------
+//When a plugin is modified, sp_internal_win32_prepare_module runs on the windows thread pool.
+//Every sp_update looks at the jobs that are pending, and the ones that are ready are published on the main thread.
+//The old module is freed back on the thread pool, so the main thread only pays for the plugin's load/unload functions
+//and the swap.
 
-    return(result);
-}
+#define SP_RELOAD_JOB_IDLE      0
+#define SP_RELOAD_JOB_PREPARING 1
+#define SP_RELOAD_JOB_READY     2
+#define SP_RELOAD_JOB_FAILED    3
 
-//Forward declare.
-bool32 sp_internal_win32_reload_plugin(SPlugin* plugin, int32 index, APIRegistry *registry);
+struct SPReloadJob
+{
+    volatile LONG state;  //written by the worker when it is done preparing
+    bool32 dirty;         //the plugin was modified again while preparing, main thread only
+    uint32 temp_index;    //increases with every attempt so we never copy over a module that is still loaded
+    int32 reloadable_index;
+    SPlugin *plugin;
+    SPPreparedModule prepared;
+};
 
+inline LONG
+sp_internal_win32_reload_job_state(SPReloadJob *job)
+{
+    return(InterlockedCompareExchange(&job->state, SP_RELOAD_JOB_IDLE, SP_RELOAD_JOB_IDLE));
+}
 
-bool32 sp_internal_reload_plugin(SPlugin* plugin, int32 index, APIRegistry *registry)
+internal DWORD WINAPI
+sp_internal_win32_reload_job_proc(LPVOID param)
 {
-     #ifdef _WIN32
-        bool32 result = sp_internal_win32_reload_plugin(plugin, index, registry);
-    #else   
-        //@TODO: Other OS
-        #error NO OTHER OS DEFINED    
-    #endif //_WIN32
+    SPReloadJob *job = (SPReloadJob *)param;
+    bool32 prepared = sp_internal_win32_prepare_module(job->plugin->file_handle, job->temp_index, &job->prepared);
+    InterlockedExchange(&job->state, prepared ? SP_RELOAD_JOB_READY : SP_RELOAD_JOB_FAILED);
+    return(0);
+}
 
-    return(result);
+internal DWORD WINAPI
+sp_internal_win32_retire_module_proc(LPVOID param)
+{
+    FreeLibrary((HMODULE)param);
+    return(0);
 }
 
-bool32 sp_internal_api_registry_check_reloadable_plugins(APIRegistry *registry)
+internal DWORD WINAPI
+sp_internal_win32_retire_module_copy_proc(LPVOID param)
 {
-    bool32 result = false;
+    sp_internal_win32_free_module_copy((HMODULE)param);
+    return(0);
+}
 
-    APIRegistry *reg = registry;
-    if(!reg)
+//copy - the module was loaded from a temp copy that should be deleted once it is freed
+internal void
+sp_internal_win32_retire_module(HMODULE module, bool32 copy)
+{
+    LPTHREAD_START_ROUTINE proc = copy ? sp_internal_win32_retire_module_copy_proc : sp_internal_win32_retire_module_proc;
+    if(module && !QueueUserWorkItem(proc, module, WT_EXECUTEDEFAULT))
     {
-        reg = sp_internal_registry_get();
+        proc(module);
     }
+}
 
-    uint32 count = reg->reloadable_count;
-    for(uint32 index = 0; index < count; ++index)
+internal void
+sp_internal_win32_reload_job_queue(SPReloadJob *job)
+{
+    job->dirty = false;
+    job->temp_index++;
+    job->prepared = {};
+    InterlockedExchange(&job->state, SP_RELOAD_JOB_PREPARING);
+    if(!QueueUserWorkItem(sp_internal_win32_reload_job_proc, job, WT_EXECUTELONGFUNCTION))
     {
-        if(sp_internal_plugin_modified(reg->reloadable_plugins[index]))
-        {
-            printf("Plugin at index : %d has been modified!\n", index);
-            SPlugin *plugin = reg->reloadable_plugins[index];
-    
-            result = sp_internal_reload_plugin(plugin, index, reg);
-            
-        }
+        //Could not queue it, do it here.
+        sp_internal_win32_reload_job_proc(job);
     }
-    return(result);
 }
 
-
-bool32 sp_update(APIRegistry *registry)
+internal void
+sp_internal_win32_reload_job_start(APIRegistry *reg, SPlugin *plugin, int32 index)
 {
-    APIRegistry *reg = registry;
-    if(!reg)
+    SPReloadJob *job = plugin->reload_job;
+    if(!job)
     {
-        reg = sp_internal_registry_get();
+        job = (SPReloadJob*)sp_internal_registry_allocate(reg, sizeof(SPReloadJob));
+        *job = {};
+        job->temp_index = plugin->reload_count;
+        plugin->reload_job = job;
     }
-    bool32 result = sp_internal_api_registry_check_reloadable_plugins(reg);
+    job->plugin = plugin;
+    job->reloadable_index = index;
 
-    return(result);
-}
+    if(job->state != SP_RELOAD_JOB_IDLE)
+    {
+        //Already pending, what is being prepared might be stale so prepare it again when it is done.
+        job->dirty = true;
+        return;
+    }
 
-bool32 sp_update()
-{
-    return(sp_update(nullptr));
+    if(reg->pending_reload_count == reg->pending_reload_capacity)
+    {
+        reg->pending_reload_capacity = reg->pending_reload_capacity ? reg->pending_reload_capacity * 2 : 8;
+        reg->pending_reloads = (SPReloadJob**)sp_internal_registry_reallocate(reg, reg->pending_reloads, sizeof(SPReloadJob*) * reg->pending_reload_capacity);
+    }
+    reg->pending_reloads[reg->pending_reload_count++] = job;
+    sp_internal_win32_reload_job_queue(job);
 }
 
-void sp_registry_destroy(APIRegistry *registry)
+//Ready reloads that would not be published before the deadline are left for the next call (the first one always runs).
+internal bool32
+sp_internal_win32_reload_jobs_update(APIRegistry *reg, int64 deadline_us)
 {
-    if(!registry)
-    {
-        registry = sp_internal_registry_get();
-    }
-    uint32 count = registry->capacity;
-    for(uint32 index = 0; index < count; ++index)
+    SP_TRACE_SCOPE("reload_jobs_update", reg->pending_reload_count);
+    bool32 result = false;
+    for(uint32 index = 0; index < reg->pending_reload_count;)
     {
-        SPlugin *plugin = &registry->plugins[index];
-        unload_func unload_function = (unload_func)plugin->unload_func;
-        if(unload_function)
+        SPReloadJob *job = reg->pending_reloads[index];
+        LONG state = sp_internal_win32_reload_job_state(job);
+        if(state == SP_RELOAD_JOB_PREPARING)
         {
-            unload_function(registry, false);
-            sp_internal_plugin_cleanup(plugin);
+            ++index;
+            continue;
         }
-    }
-    free(registry->plugins);
-    *registry = {};
-}
-//
-//End API Registry ----------------------------------------------------
-
 
+        if(job->dirty)
+        {
+            sp_internal_win32_retire_module(job->prepared.library_handle, true);
+            sp_internal_win32_reload_job_queue(job);
+            ++index;
+            continue;
+        }
 
-// Plugin Functions
+        if(state == SP_RELOAD_JOB_READY)
+        {
+            int64 start_time = sp_internal_win32_get_time_us();
+            if(result && deadline_us - start_time < job->plugin->reload_cost_us)
+            {
+                ++index;
+                continue;
+            }
+            HMODULE old_plugin_handle = sp_internal_win32_publish_module(job->plugin, &job->prepared, reg);
+            sp_internal_registry_retire(reg, SP_RETIRE_MODULE_COPY, old_plugin_handle);
+            int64 end_time = sp_internal_win32_get_time_us();
+            job->plugin->reload_cost_us = end_time - start_time;
+            #ifdef SP_ENABLE_STATS
+            sp_internal_plugin_record_stall(job->plugin, end_time - start_time);
+            #endif //SP_ENABLE_STATS
+            result = true;
+        }
+        else
+        {
+            //@TODO: Log could not prepare the plugin.
+            #ifdef SP_ENABLE_STATS
+            job->plugin->stats.failed_reloads++;
+            #endif //SP_ENABLE_STATS
+            sp_internal_win32_retire_module(job->prepared.library_handle, true);
+        }
 
+        job->state = SP_RELOAD_JOB_IDLE;
+        reg->pending_reloads[index] = reg->pending_reloads[--reg->pending_reload_count];
+    }
+    return(result);
+}
 
-SPlugin * sp_internal_win32_load_plugin(char* plugin_name, bool32 reloadable, APIRegistry *registry = nullptr)
+//Waits for a pending reload of the plugin to finish and throws it away, used before unloading a plugin.
+internal void
+sp_internal_win32_reload_job_cancel(APIRegistry *reg, SPlugin *plugin)
 {
-    APIRegistry *reg = registry;
-    if(!reg)
+    SPReloadJob *job = plugin->reload_job;
+    if(!job)
     {
-        reg = sp_internal_registry_get();
+        return;
     }
-    SPlugin *plugin = sp_internal_api_registry_add_new_plugin(reg); 
-    plugin->hash = SP_HASH(plugin_name);
-    plugin->reloadable = reloadable;
-        
-    StrBuffer temp_plugin_name = {};
-    sp_string_build_tmp_name(plugin_name, &temp_plugin_name);
-    
-    if(!CopyFile(plugin_name,temp_plugin_name.buffer,0))
+    while(sp_internal_win32_reload_job_state(job) == SP_RELOAD_JOB_PREPARING)
     {
-        return false;
-        //@TODO: Log could not COPY plugin to temp_plugin.
+        Sleep(0);
     }
-
-    plugin->library_handle = LoadLibraryA(temp_plugin_name.buffer);
-
-    if(reloadable) 
+    if(job->state != SP_RELOAD_JOB_IDLE)
     {
-        //Get the information we need to monitor the plugin.
-        plugin->file_handle = CreateFile(plugin_name,0,0,0,OPEN_EXISTING,0,0);
-        FILETIME last_write_time = {};
-        GetFileTime(plugin->file_handle,0,0,&last_write_time);
-        plugin->last_write_time = last_write_time;
-        //Add the plugin to the list so the registry can monitor it.
-        reg->reloadable_plugins[reg->reloadable_count++] = plugin;
+        sp_internal_win32_free_module_copy(job->prepared.library_handle);
+        for(uint32 index = 0; index < reg->pending_reload_count; ++index)
+        {
+            if(reg->pending_reloads[index] == job)
+            {
+                reg->pending_reloads[index] = reg->pending_reloads[--reg->pending_reload_count];
+                break;
+            }
+        }
     }
+    sp_internal_registry_free(reg, job);
+    plugin->reload_job = nullptr;
+}
 
-    if(!plugin->library_handle)
+SPlugin *
+sp_load_plugin(APIRegistry *registry, char* plugin_name, bool32 reloadable)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
     {
-        return false;
-        //@TODO: Log could not Load plugin
+        reg = sp_internal_registry_get();
     }
 
-    //call the plugin load function
-    StrBuffer load_function_name = {};
-    sp_string_build_load_function_name(plugin_name,&load_function_name);
-    
-    load_func load_function = (load_func)GetProcAddress(plugin->library_handle,load_function_name.buffer);
-    if(!load_function)
-    {
-        SP_Assert(!"Could not locate the plugin load function!!!");
-    }
-    load_function(reg, false);
+    SPlugin *plugin = nullptr;
+    #ifdef _WIN32
+    plugin = sp_internal_win32_load_plugin(plugin_name, reloadable, reg);
+    #else
+        //@TODO: Add other OS
+        #error NO OTHER OS DEFINED
+    #endif //_WIN32
+
+    //Make the new API visible to sp_get_api.
+    sp_internal_registry_publish(reg);
 
-    //finally let's save the address of the unload function
-    StrBuffer unload_function_name = {};
-    sp_string_build_unload_function_name(plugin_name,&unload_function_name);
-    plugin->unload_func = GetProcAddress(plugin->library_handle,unload_function_name.buffer);
-    if(!plugin->unload_func)
-    {
-        SP_Assert(!"Could not locate the plugin UNLOAD function!!!");
-    }
-    
     return (plugin);
 }
+    
 
-
-bool32 sp_internal_win32_reload_plugin(SPlugin* plugin, int32 index, APIRegistry* registry)
+SPlugin *
+sp_load_plugin(char* plugin_name, bool32 reloadable)
 {
-    //Load the new plugin
-    char buffer[256];
-    char plugin_name[256];
-    StrBuffer new_plugin_name = {};
-    GetFinalPathNameByHandle(plugin->file_handle, buffer, 256, VOLUME_NAME_NONE) ; 
-    sp_string_extract_plugin_name(buffer, plugin_name);
-    sp_string_build_tmp_name(plugin_name, &new_plugin_name, plugin->reload_count + 1);
+    return(sp_load_plugin(nullptr, plugin_name, reloadable));
+}
 
+void sp_load_plugin_lazy(APIRegistry *registry, char* plugin_name, char* api_name, bool32 reloadable)
+{
     APIRegistry *reg = registry;
     if(!reg)
     {
         reg = sp_internal_registry_get();
-    
     }
 
-    SPlugin *new_plugin = sp_internal_api_registry_add_new_plugin(reg); 
-    new_plugin->hash = SP_HASH(plugin_name);
-    new_plugin->reloadable = 1;
-    new_plugin->reload_count = plugin->reload_count + 1;
-    new_plugin->file_handle = plugin->file_handle;
-    new_plugin->last_write_time = plugin->last_write_time;
-    
-    if(!CopyFile(plugin_name,new_plugin_name.buffer,0))
+    if(reg->lazy_count == reg->lazy_capacity)
     {
-        return false;
-        //@TODO: Log could not COPY plugin to temp_plugin.
+        reg->lazy_capacity = reg->lazy_capacity ? reg->lazy_capacity * 2 : 8;
+        reg->lazy_plugins = (SPLazyPlugin*)sp_internal_registry_reallocate(reg, reg->lazy_plugins, sizeof(SPLazyPlugin) * reg->lazy_capacity);
     }
-
-    new_plugin->library_handle = LoadLibraryA(new_plugin_name.buffer);
-    //@TODO: Get the new time to keep track.
-
-     if(!new_plugin->library_handle)
+    SPLazyPlugin *lazy = &reg->lazy_plugins[reg->lazy_count++];
+    *lazy = {};
+    lazy->api_hash = SP_HASH(api_name);
+    lazy->reloadable = reloadable;
+    uint32 length = 0;
+    for(; plugin_name[length] && length < (sizeof(lazy->plugin_name) - 1); ++length)
     {
-        return false;
-        //@TODO: Log could not Load plugin
+        lazy->plugin_name[length] = plugin_name[length];
     }
-    StrBuffer load_function_name = {};
-    sp_string_build_load_function_name(plugin_name,&load_function_name);
-    
-    load_func load_function = (load_func)GetProcAddress(new_plugin->library_handle,load_function_name.buffer);
-    if(!load_function)
+    lazy->plugin_name[length] = '\0';
+}
+
+void sp_load_plugin_lazy(char* plugin_name, char* api_name, bool32 reloadable)
+{
+    sp_load_plugin_lazy(nullptr, plugin_name, api_name, reloadable);
+}
+
+SPLoadBatch *
+sp_load_plugins_async(APIRegistry *registry, char** plugin_names, uint32 count, uint32 flags)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
     {
-        SP_Assert(!"Could not locate the plugin load function!!!");
+        reg = sp_internal_registry_get();
     }
-    load_function(reg, true);
-    
-    //finally let's save the address of the unload function
-    StrBuffer unload_function_name = {};
-    sp_string_build_unload_function_name(plugin_name,&unload_function_name);
-    new_plugin->unload_func = GetProcAddress(new_plugin->library_handle,unload_function_name.buffer);
-    if(!new_plugin->unload_func)
+
+    SPLoadBatch *batch = (SPLoadBatch*)sp_internal_registry_allocate(reg, sizeof(SPLoadBatch));
+    *batch = {};
+    batch->registry = reg;
+    batch->count = count;
+    batch->remaining = count;
+    batch->requests = (SPLoadRequest*)sp_internal_registry_allocate(reg, sizeof(SPLoadRequest) * (count ? count : 1));
+    memset(batch->requests, 0, sizeof(SPLoadRequest) * (count ? count : 1));
+    #ifdef _WIN32
+    batch->done_event = CreateEventA(0, TRUE, count ? FALSE : TRUE, 0);
+    for(uint32 index = 0; index < count; ++index)
     {
-        SP_Assert(!"Could not locate the plugin UNLOAD function!!!");
+        SPLoadRequest *request = &batch->requests[index];
+        request->plugin_name = plugin_names[index];
+        request->reloadable = (flags & SP_LOAD_RELOADABLE) != 0;
+        request->batch = batch;
+        if(!QueueUserWorkItem(sp_internal_win32_open_plugin_proc, request, WT_EXECUTELONGFUNCTION))
+        {
+            //Could not queue it, do it here.
+            sp_internal_win32_open_plugin_proc(request);
+        }
     }
+    #else
+        //@TODO: Add other OS
+        #error NO OTHER OS DEFINED
+    #endif //_WIN32
 
-    //@TODO: If I want to implement some sort of state transfer between the dlls it goes here.
-    //       In here both plugins are loaded at the same time
-    //
-    //
-
-    HMODULE old_plugin_handle = plugin->library_handle;
-
-    unload_func unload_function = (unload_func)plugin->unload_func;
-    unload_function(reg, true);
-
-    FreeLibrary(old_plugin_handle);
-
-    reg->reloadable_plugins[index] = new_plugin;
+    return(batch);
+}
 
+SPLoadBatch *
+sp_load_plugins_async(char** plugin_names, uint32 count, uint32 flags)
+{
+    return(sp_load_plugins_async(nullptr, plugin_names, count, flags));
+}
 
-    
-    return true;
+bool32 sp_load_batch_ready(SPLoadBatch *batch)
+{
+    return(InterlockedCompareExchange(&batch->remaining, 0, 0) == 0);
 }
 
-SPlugin *
-sp_load_plugin(APIRegistry *registry, char* plugin_name, bool32 reloadable)
+uint32 sp_load_batch_finish(SPLoadBatch *batch, SPlugin** plugins)
 {
-    SPlugin *plugin = nullptr;
+    SP_TRACE_SCOPE("load_batch_finish", batch->count);
+    uint32 loaded = 0;
     #ifdef _WIN32
-    plugin = sp_internal_win32_load_plugin(plugin_name, reloadable, registry);
+    WaitForSingleObject(batch->done_event, INFINITE);
+    CloseHandle(batch->done_event);
+
+    //Registering in order keeps the registry the same from run to run, no matter which plugin was opened first.
+    for(uint32 index = 0; index < batch->count; ++index)
+    {
+        SPLoadRequest *request = &batch->requests[index];
+        SPlugin *plugin = nullptr;
+        if(request->opened)
+        {
+            plugin = sp_internal_win32_register_plugin(batch->registry, request);
+            ++loaded;
+        }
+        if(plugins)
+        {
+            plugins[index] = plugin;
+        }
+    }
     #else
         //@TODO: Add other OS
         #error NO OTHER OS DEFINED
     #endif //_WIN32
 
-    return (plugin);
+    //Make the new APIs visible to sp_get_api, once for the whole batch.
+    sp_internal_registry_publish(batch->registry);
+
+    sp_internal_registry_free(batch->registry, batch->requests);
+    sp_internal_registry_free(batch->registry, batch);
+    return(loaded);
 }
-    
 
-SPlugin *
-sp_load_plugin(char* plugin_name, bool32 reloadable)
+uint32 sp_load_plugins(APIRegistry *registry, char** plugin_names, uint32 count, uint32 flags, SPlugin** plugins)
 {
-    return(sp_load_plugin(nullptr, plugin_name, reloadable));
+    SPLoadBatch *batch = sp_load_plugins_async(registry, plugin_names, count, flags);
+    return(sp_load_batch_finish(batch, plugins));
+}
+
+uint32 sp_load_plugins(char** plugin_names, uint32 count, uint32 flags, SPlugin** plugins)
+{
+    return(sp_load_plugins(nullptr, plugin_names, count, flags, plugins));
 }
 
 void sp_unload_plugin(APIRegistry * registry,char* api_name)
@@ -1111,19 +4681,27 @@ void sp_unload_plugin(APIRegistry * registry,char* api_name)
 
     uint64 desired_api_hash = SP_HASH(api_name);
 
-    SPlugin *plugin = reg->plugins;
-    uint32 count   = reg->capacity; 
-    for(uint32 index = 0; index < count; ++index )
+    //A lazy plugin that was never used is just forgotten.
+    int32 lazy_index = sp_internal_lazy_find(reg, desired_api_hash);
+    if(lazy_index != -1)
     {
-        plugin = &reg->plugins[index];
-        if(desired_api_hash == plugin->api_hash)
-        {
-            unload_func unload_function = (unload_func)plugin->unload_func;
-            unload_function(reg, false);
-            sp_internal_plugin_cleanup(plugin);
-            *plugin = {}; //reset this slot
-            break;
-        }
+        sp_internal_lazy_remove(reg, lazy_index);
+    }
+
+    int32 slot = sp_internal_index_find(reg, desired_api_hash);
+    if(slot != SP_INDEX_EMPTY)
+    {
+        SPlugin *plugin = sp_internal_registry_slot(reg, slot);
+        sp_internal_win32_reload_job_cancel(reg, plugin);
+        unload_func unload_function = (unload_func)plugin->unload_func;
+        unload_function(reg, false);
+        //The unload function should have removed the api already, this is in case it did not.
+        sp_internal_index_remove(reg, desired_api_hash, slot);
+        reg->view_dirty = true;
+        sp_internal_registry_publish(reg);
+        sp_internal_plugin_cleanup(reg, plugin);
+        sp_internal_plugin_reset(reg, plugin); //reset this slot
+        sp_internal_registry_compact(reg);
     }
 }
 
@@ -1134,10 +4712,15 @@ void sp_unload_plugin(APIRegistry * registry,SPlugin *plugin)
     {
         reg = sp_internal_registry_get();
     }
+    sp_internal_win32_reload_job_cancel(reg, plugin);
     unload_func unload_function = (unload_func)plugin->unload_func;
     unload_function(reg, false);
-    sp_internal_plugin_cleanup(plugin);
-    *plugin = {}; //reset this slot
+    sp_internal_index_remove(reg, sp_internal_plugin_api_hash(reg, plugin), (int32)plugin->index);
+    reg->view_dirty = true;
+    sp_internal_registry_publish(reg);
+    sp_internal_plugin_cleanup(reg, plugin);
+    sp_internal_plugin_reset(reg, plugin); //reset this slot
+    sp_internal_registry_compact(reg);
 }
 
 void sp_unload_plugin(char* api_name)
@@ -1150,6 +4733,42 @@ void sp_unload_plugin(SPlugin *plugin)
     sp_unload_plugin(nullptr, plugin);
 }
 
+SPluginHandle sp_get_plugin_handle(SPlugin *plugin)
+{
+    SPluginHandle handle = {};
+    if(plugin)
+    {
+        handle.index      = plugin->index;
+        handle.generation = plugin->generation;
+    }
+    return(handle);
+}
+
+SPlugin * sp_get_plugin(APIRegistry *registry, SPluginHandle handle)
+{
+    APIRegistry *reg = registry;
+    if(!reg)
+    {
+        reg = sp_internal_registry_get();
+    }
+
+    if(handle.index >= (uint32)reg->capacity)
+    {
+        return(nullptr);
+    }
+    SPlugin *plugin = sp_internal_registry_slot(reg, handle.index);
+    if(plugin->generation != handle.generation || !sp_plugin_is_initialized(reg, plugin))
+    {
+        return(nullptr);
+    }
+    return(plugin);
+}
+
+SPlugin * sp_get_plugin(SPluginHandle handle)
+{
+    return(sp_get_plugin(nullptr, handle));
+}
+
 
 
 
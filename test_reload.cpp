@@ -0,0 +1,220 @@
+//Tests of hot reloading a plugin while its file is being rewritten.
+//The file is written back in a few chunks, the way a linker writes it. The registry sees every chunk but the plugin
+//should only be reloaded once the file stopped changing (See SP_RELOAD_DEBOUNCE_MS).
+//  - A rewrite reloads the plugin exactly once.
+//  - A rewrite that starts while the reload of an earlier one is in flight still ends with the plugin reloaded once
+//    more, and nothing is left pending.
+//build.bat builds it as is (file watcher), with SP_DISABLE_FILE_WATCHER (polling) and with SP_ASYNC_RELOAD.
+//Run it from the build directory once sample_plugin.dll has been built, it returns 0 when every test passed.
+
+#include<Windows.h>
+
+#include <stdio.h>
+
+#define SIMPLE_PLUGIN_IMPLEMENTATION
+#include "simple_plugin.h"
+
+#include "sample_plugin.h"
+
+#define TEST_CHUNK_COUNT 4
+//Time between the chunks, shorter than the debounce time.
+#define TEST_CHUNK_MS    (SP_RELOAD_DEBOUNCE_MS / 4)
+//How long sp_update is called for after the rewrite, long enough for any extra reload to show up.
+#define TEST_WAIT_MS     (SP_RELOAD_DEBOUNCE_MS * 10)
+
+char* sample_plugin = "sample_plugin.dll";
+
+//Calls sp_update once and returns how many times plugin was reloaded by it.
+internal uint32
+test_update(SPlugin *plugin)
+{
+    uint32 reloads = 0;
+    if(sp_update())
+    {
+        SPlugin *reloaded[16];
+        uint32 count = sp_get_reloaded_plugins(reloaded, 16);
+        for(uint32 index = 0; index < count; ++index)
+        {
+            if(reloaded[index] == plugin)
+            {
+                ++reloads;
+            }
+        }
+    }
+    return(reloads);
+}
+
+//Calls sp_update for wait_ms and returns how many times plugin was reloaded.
+internal uint32
+test_count_reloads(SPlugin *plugin, uint32 wait_ms)
+{
+    uint32 reloads = 0;
+    LARGE_INTEGER frequency, start, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    do
+    {
+        reloads += test_update(plugin);
+        Sleep(1);
+        QueryPerformanceCounter(&now);
+    }
+    while((now.QuadPart - start.QuadPart) * 1000 < (int64)wait_ms * frequency.QuadPart);
+    return(reloads);
+}
+
+//True once the reload of plugin has started and until it is published.
+internal bool32
+test_reload_in_flight(SPlugin *plugin)
+{
+    #ifdef SP_ASYNC_RELOAD
+    //The new version is prepared on the thread pool, then published by a later sp_update.
+    return(plugin->reload_job && sp_internal_win32_reload_job_state(plugin->reload_job) != SP_RELOAD_JOB_IDLE);
+    #else
+    //The reload itself runs inside sp_update, until then it waits for the file to settle.
+    return(plugin->reload_pending);
+    #endif //SP_ASYNC_RELOAD
+}
+
+//Rewrites the file with the same contents, sp_update keeps being called while it is written.
+//reloads gets the number of times plugin was reloaded in the middle of the rewrite.
+internal bool32
+test_rewrite_file(char *file_name, SPlugin *plugin, uint32 *reloads)
+{
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        return(false);
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    DWORD file_size = (DWORD)size.QuadPart;
+    uint8 *contents = (uint8*)malloc(file_size);
+    DWORD read = 0;
+    ReadFile(file, contents, file_size, &read, 0);
+    CloseHandle(file);
+    if(read != file_size)
+    {
+        free(contents);
+        return(false);
+    }
+
+    //A reload that is copying the file keeps it open for a moment, so the open is retried like a linker would.
+    file = CreateFileA(file_name, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    for(uint32 waited = 0; file == INVALID_HANDLE_VALUE && waited < TEST_WAIT_MS; ++waited)
+    {
+        *reloads += test_count_reloads(plugin, 1);
+        file = CreateFileA(file_name, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    }
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        free(contents);
+        return(false);
+    }
+    DWORD chunk_size = (file_size + TEST_CHUNK_COUNT - 1) / TEST_CHUNK_COUNT;
+    for(DWORD offset = 0; offset < file_size; offset += chunk_size)
+    {
+        DWORD to_write = (file_size - offset < chunk_size) ? (file_size - offset) : chunk_size;
+        DWORD written = 0;
+        WriteFile(file, contents + offset, to_write, &written, 0);
+        FlushFileBuffers(file);
+        *reloads += test_count_reloads(plugin, TEST_CHUNK_MS);
+    }
+    CloseHandle(file);
+    free(contents);
+    return(true);
+}
+
+internal bool32
+test_rewrite_once(SPlugin *plugin)
+{
+    //Nothing changed yet, nothing should be reloaded.
+    uint32 reloads = test_count_reloads(plugin, TEST_WAIT_MS);
+    if(reloads != 0)
+    {
+        printf("FAILED: %u reloads before the plugin was rewritten\n", reloads);
+        return(false);
+    }
+
+    if(!test_rewrite_file(sample_plugin, plugin, &reloads))
+    {
+        printf("FAILED: could not rewrite %s\n", sample_plugin);
+        return(false);
+    }
+
+    reloads += test_count_reloads(plugin, TEST_WAIT_MS);
+    if(reloads != 1)
+    {
+        printf("FAILED: %u reloads after the plugin was rewritten once\n", reloads);
+        return(false);
+    }
+    return(true);
+}
+
+internal bool32
+test_rewrite_in_flight(SPlugin *plugin)
+{
+    uint32 reloads = 0;
+    if(!test_rewrite_file(sample_plugin, plugin, &reloads))
+    {
+        printf("FAILED: could not rewrite %s\n", sample_plugin);
+        return(false);
+    }
+
+    //Update one call at a time so the rewrite below starts as soon as the reload is in flight.
+    bool32 in_flight = test_reload_in_flight(plugin);
+    for(uint32 waited = 0; !in_flight && !reloads && waited < TEST_WAIT_MS; ++waited)
+    {
+        reloads += test_update(plugin);
+        in_flight = test_reload_in_flight(plugin);
+        Sleep(1);
+    }
+    if(!in_flight)
+    {
+        printf("FAILED: the reload was %s before the plugin could be rewritten again\n", reloads ? "published" : "never started");
+        return(false);
+    }
+
+    //The first reload can still be published while the file is being written again, but the last one has to come
+    //after the second rewrite.
+    uint32 reloads_during = 0;
+    if(!test_rewrite_file(sample_plugin, plugin, &reloads_during))
+    {
+        printf("FAILED: could not rewrite %s while it was being reloaded\n", sample_plugin);
+        return(false);
+    }
+    uint32 reloads_after = test_count_reloads(plugin, TEST_WAIT_MS);
+    if(reloads_during > 1 || reloads_after != 1)
+    {
+        printf("FAILED: %u reloads during and %u after a rewrite that started while a reload was in flight\n",
+               reloads_during, reloads_after);
+        return(false);
+    }
+    if(test_reload_in_flight(plugin))
+    {
+        printf("FAILED: a reload is still in flight after the plugin settled\n");
+        return(false);
+    }
+    return(true);
+}
+
+int main()
+{
+    SPlugin *plugin = sp_load_plugin(sample_plugin, true);
+    if(!plugin)
+    {
+        printf("FAILED: could not load %s\n", sample_plugin);
+        return(1);
+    }
+
+    if(!test_rewrite_once(plugin) || !test_rewrite_in_flight(plugin))
+    {
+        return(1);
+    }
+
+    sample_plugin_api *sample_api = sp_get_api<sample_plugin_api>();
+    sample_api->my_print();
+
+    sp_registry_destroy(nullptr);
+    printf("PASSED\n");
+    return(0);
+}